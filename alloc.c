@@ -1,13 +1,27 @@
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "alloc.h"
+
 // metadata struct
 typedef struct metadata {
     size_t size;        // size of block
     int free;           // is free or not
-    int padding;        // ensures alignment
+    int kind;           // which allocator owns the block, also ensures alignment
     struct metadata* next;   // next ptr
     struct metadata* prev;   // prev ptr
 } metadata_t;
@@ -16,10 +30,388 @@ typedef struct footer {
     size_t size;        // size of block
 } footer_t;
 
+// block kinds
+#define KIND_HEAP 0     // boundary-tag heap (sbrk or persistent)
+#define KIND_RUN 1      // page run inside a run chunk
+#define KIND_HUGE 2     // dedicated mapping
+#define KIND_MEMFD 3    // dedicated shared mapping of a memfd
+#define KIND_COW 4      // copy-on-write view of a memfd shared with its clones
+#define KIND_RECLAIM 5  // dedicated mapping the allocator may discard while unpinned
+
+#define PAGE 4096
+
+// page-run engine for medium allocations, sizes in [RUN_MIN, mmap_threshold]
+#define RUN_MIN (16 * 1024)
+#define RUN_CHUNK_SIZE (4 * 1024 * 1024)
+#define RUN_CHUNK_PAGES (RUN_CHUNK_SIZE / PAGE)
+
+// run states
+#define RUN_ALLOCATED 0
+#define RUN_DIRTY 1     // freed, pages still resident
+#define RUN_PURGED 2    // freed and released with MADV_DONTNEED, reads as zero
+#define RUN_ZEROED 3    // untouched since the chunk was mapped
+#define RUN_STATES 4
+
+// bookkeeping for the run starting at a page, kept in the chunk header so
+// free runs are never written to
+typedef struct run {
+    struct run* next;   // next free run of the same state and length
+    struct run* prev;   // prev free run of the same state and length
+    uint64_t dirtied;   // when a dirty run was freed, in ms
+    int nodump;         // the free run is excluded from core dumps
+    int padding;        // ensures alignment
+} run_t;
+
+// run chunks are RUN_CHUNK_SIZE aligned so a run finds its chunk by masking
+typedef struct run_chunk {
+    size_t free_pages;
+    uint16_t pages[RUN_CHUNK_PAGES];    // run length, at the first and last page of each run
+    uint8_t state[RUN_CHUNK_PAGES];     // run state, at the first and last page of each run
+    run_t runs[RUN_CHUNK_PAGES];        // valid at the first page of each free run
+} run_chunk_t;
+
+#define RUN_HEADER_PAGES ((sizeof(run_chunk_t) + PAGE - 1) / PAGE)
+#define RUN_MAX_PAGES (RUN_CHUNK_PAGES - RUN_HEADER_PAGES)
+
+// freed huge mappings kept for reuse
+typedef struct huge_cached {
+    void* base;
+    size_t map_size;
+    uint64_t freed;     // when the mapping was freed, in ms
+} huge_cached_t;
+
+#define HUGE_CACHE_SLOTS 8
+
+// memfd backing a family of cloned blocks, pointed to from the word before
+// the header of each of its mappings
+typedef struct clone_file {
+    int fd;
+    int refs;                   // mappings of the file
+    metadata_t* shared;         // block mapping it MAP_SHARED, NULL once frozen
+    struct clone_file* next;    // next file in shared_files
+} clone_file_t;
+
+// coroutine frames up to FRAME_CLASSES * FRAME_QUANTUM bytes are recycled per thread
+#define FRAME_QUANTUM 64
+#define FRAME_CLASSES 64
+
+// small objects come from 64 KB slabs owned by one thread each, carved out
+// of a single reserved region so free() can recognize them by address
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_QUANTUM 16
+#define SLAB_CLASSES 16         // objects up to SLAB_CLASSES * SLAB_QUANTUM bytes
+#define SLAB_REGION_SIZE (4UL << 30)
+#define SLAB_SCAN 8             // full slabs checked for remote frees per refill
+#define CACHE_LINE 64
+
+// slab states
+#define SLAB_CURRENT 0  // being allocated from
+#define SLAB_PARTIAL 1  // has objects freed by its owner
+#define SLAB_FULL 2     // may only have objects freed by other threads
+#define SLAB_ORPHAN 3   // owner exited
+
+typedef struct slab {
+    struct slab_cache* owner;   // thread cache allocating from it, NULL while orphaned or unused
+    struct slab* next;
+    struct slab* prev;
+    void* free_list;            // objects freed by the owner
+    char* bump;                 // first object never handed out
+    size_t size;                // object size
+    size_t live;                // objects handed out and not yet seen freed
+    int class;
+    int state;
+    // pushed to by other threads, kept off the owner's cache line
+    void* remote __attribute__((aligned(CACHE_LINE)));
+} slab_t;
+
+#define SLAB_HEADER ((sizeof(slab_t) + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1))
+
+// per-thread slabs, by class
+typedef struct slab_cache {
+    slab_t* current[SLAB_CLASSES];
+    slab_t* partial[SLAB_CLASSES];
+    slab_t* full[SLAB_CLASSES];
+} slab_cache_t;
+
+// churn profiler: call sites of sampled allocations, the sampled blocks
+// still live, and a counting filter that lets free() skip the lookup
+#define PROF_DEPTH 6
+#define PROF_SITES 1024
+#define PROF_LIVE 65536
+#define PROF_FILTER 65536
+#define PROF_REPORT 20
+
+typedef struct prof_site {
+    uint64_t hash;          // 0 for an unused slot
+    void* frames[PROF_DEPTH];
+    int depth;
+    double allocs;          // estimated allocations
+    double bytes;           // estimated bytes allocated
+    double frees;           // estimated allocations freed again
+    double lifetime_ns;     // total lifetime of the freed ones
+} prof_site_t;
+
+typedef struct prof_live {
+    void* ptr;              // NULL for an unused slot
+    uint64_t allocated;     // when, in ns
+    double weight;
+    int site;
+} prof_live_t;
+
+// slow-operation watchdog: operations, the phases their time is broken
+// down into, and the records of slow calls kept in a ring
+#define OP_MALLOC ALLOC_TRACE_MALLOC
+#define OP_CALLOC ALLOC_TRACE_CALLOC
+#define OP_REALLOC ALLOC_TRACE_REALLOC
+#define OP_FREE ALLOC_TRACE_FREE
+
+#define PHASE_SEARCH 0      // free list and run bin scans
+#define PHASE_SPLIT 1
+#define PHASE_COALESCE 2
+#define PHASE_SYSCALL 3     // sbrk, mmap, mremap, munmap
+#define PHASE_COPY 4        // realloc moving data
+#define PHASE_ZERO 5        // calloc clearing memory
+#define WATCH_PHASES 6
+
+// times the enclosing entry point, up to whichever return it takes
+#define WATCH_OP(op, size) int watch_active __attribute__((cleanup(watch_leave))) = watch_enter(op, size)
+
+#define WATCH_RING 256
+#define WATCH_DEPTH 8
+
+// the operation the calling thread is in, nested calls count toward it
+typedef struct watch_op {
+    int depth;
+    int busy;               // taking a backtrace, which may allocate
+    int op;
+    size_t size;
+    uint64_t start;         // in ticks
+    uint64_t claimed;       // ticks added to phases so far
+    uint64_t phases[WATCH_PHASES];
+} watch_op_t;
+
+typedef struct watch_record {
+    uint64_t seq;           // index + 1 once written, 0 while being written
+    int op;
+    int depth;
+    size_t size;
+    uint64_t total_ns;
+    uint64_t phase_ns[WATCH_PHASES];
+    void* frames[WATCH_DEPTH];
+} watch_record_t;
+
+// mapping queued for the reclaimer thread, stored in its own first page
+typedef struct release {
+    size_t len;
+    struct release* next;
+} release_t;
+
+// reclaimable block state, just before its header; the mapping starts with
+// the saved first word of each user page while the block is unpinned
+typedef struct reclaim {
+    size_t header;      // bytes in front of user memory
+    int pins;           // blocks start out pinned
+    int discarded;      // released by the allocator while unpinned
+} reclaim_t;
+
+#define RECLAIM_CANARY 0x4d49414c434552ULL  // "RECLAIM"
+
+// a boundary-tag heap: its free list plus the [heap_start, heap_top) range
+typedef struct heap {
+    metadata_t* free_list_head;
+    void* heap_start;
+    void* heap_top;
+    void* heap_end;     // end of the reserved region, NULL for the sbrk heap
+} heap_t;
+
+// persistent heap header, lives at the start of the backing file
+typedef struct pheap_header {
+    uint64_t magic;
+    void* base;         // address the file was mapped at
+    size_t capacity;    // length of the mapping, header included
+    int clean;          // set by pheap_close, cleared while the heap is open
+    int padding;        // ensures alignment
+    void* root;         // user root pointer
+    heap_t heap;
+} pheap_header_t;
+
+#define PHEAP_MAGIC 0x31305041454850ULL    // "PHEAP01"
+
 // global vars
-static metadata_t* free_list_head = NULL;
-static void* heap_top = NULL;
-static void* heap_start = NULL;
+static heap_t main_heap = {NULL, NULL, NULL, NULL};
+static pheap_header_t* pheap = NULL;
+static int pheap_fd = -1;
+
+// program break as last moved by us, [heap_top, heap_break) is the top reserve
+static void* heap_break = NULL;
+static pthread_mutex_t grow_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pregrow_cond = PTHREAD_COND_INITIALIZER;
+static int pregrow_started = 0;
+static int pregrow_touch = 0;   // kernel lacks MADV_POPULATE_WRITE
+// part of the top reserve the pre-growth thread left out of core dumps,
+// [nodump_mark, nodump_end) holds every such page not yet handed out
+static char* nodump_mark = NULL;
+static char* nodump_end = NULL;
+
+// free runs binned by state and page count, with a bitmap of non-empty bins
+static run_t* run_bins[RUN_STATES][RUN_CHUNK_PAGES];
+static uint64_t run_bin_map[RUN_STATES][RUN_CHUNK_PAGES / 64];
+static size_t run_chunks = 0;
+static uint64_t run_last_purge = 0;
+
+// oldest first
+static huge_cached_t huge_cache[HUGE_CACHE_SLOTS];
+static size_t huge_cache_count = 0;
+static size_t huge_cache_bytes = 0;
+// the reclaimer thread ages the cache while the program runs
+static pthread_mutex_t huge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// churn profiler state, all but the sampling countdowns under prof_lock
+static prof_site_t prof_sites[PROF_SITES];
+static size_t prof_site_count = 0;
+static prof_live_t prof_live[PROF_LIVE];
+static size_t prof_live_count = 0;
+static uint8_t prof_filter[PROF_FILTER];
+static uint64_t prof_start = 0;
+static uintptr_t prof_text_start = 0;  // our own code, left out of call sites
+static uintptr_t prof_text_end = 0;
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int64_t prof_countdown __attribute__((tls_model("initial-exec")));
+static __thread uint64_t prof_random __attribute__((tls_model("initial-exec")));
+static __thread int prof_busy __attribute__((tls_model("initial-exec")));
+
+// watchdog state; ticks are TSC cycles where available, ns otherwise
+static watch_record_t watch_ring[WATCH_RING];
+static uint64_t watch_head = 0;
+static uint64_t watch_threshold = 0;    // in ticks
+static double watch_tick_ns = 1.0;
+static __thread watch_op_t watch_op __attribute__((tls_model("initial-exec")));
+
+// calls waiting to be written to trace_fd
+#define TRACE_BUFFER 256
+static alloc_trace_t trace_buffer[TRACE_BUFFER];
+static size_t trace_count = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// pages of the main heap from here to its top were given back by trimming
+// and have not been handed out since
+static char* trim_mark = NULL;
+
+// mappings waiting to be unmapped by the reclaimer thread
+static release_t* release_queue = NULL;
+static release_t* release_queue_tail = NULL;
+static size_t release_pending = 0;     // bytes queued or being unmapped
+static pthread_mutex_t release_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t release_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t release_done = PTHREAD_COND_INITIALIZER;
+static int release_started = 0;
+
+// unpinned reclaimable blocks, least recently unpinned first
+static metadata_t* reclaim_head = NULL;
+static metadata_t* reclaim_tail = NULL;
+
+// slab region, slabs that are not owned by any thread and this thread's cache
+static char* slab_region = NULL;
+static size_t slab_region_used = 0;
+static slab_t* slab_orphans[SLAB_CLASSES];
+static slab_t* slab_unused = NULL;
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key;
+static __thread slab_cache_t* slab_cache __attribute__((tls_model("initial-exec")));
+
+// files still mapped MAP_SHARED by their block, frozen before fork
+static clone_file_t* shared_files = NULL;
+static pthread_once_t clone_once = PTHREAD_ONCE_INIT;
+
+// per-thread LIFO lists of recycled frames, one per size class, linked through their first word
+static __thread void* frame_lists[FRAME_CLASSES] __attribute__((tls_model("initial-exec")));
+static __thread size_t frame_counts[FRAME_CLASSES] __attribute__((tls_model("initial-exec")));
+static __thread int frame_registered __attribute__((tls_model("initial-exec")));
+static pthread_key_t frame_key;
+static pthread_once_t frame_once = PTHREAD_ONCE_INIT;
+
+// tunables, set through the ALLOC_CONF environment variable
+static size_t grow_step = 64 * 1024;    // minimum sbrk increment
+static size_t pregrow_low = 0;          // top reserve low watermark, 0 disables pre-growth
+static size_t pregrow_step = 0;         // bytes added per pre-growth, defaults to 2 * pregrow_low
+static size_t mmap_threshold = 1024 * 1024; // larger requests get their own mapping
+static size_t split_min = 8;            // smallest remainder split off a heap block, at least 8
+static size_t trim_threshold = 0;       // free space at the heap top at least this large is released, 0 disables
+static size_t decay_ms = 1000;          // age at which dirty runs are purged, 0 purges on free
+static size_t huge_cache_max = 4UL << 30;   // bytes of freed huge mappings kept for reuse
+static size_t dontdump_min = 1024 * 1024;   // free memory at least this large is left out of core dumps, 0 disables
+static size_t frame_cache = 256;        // recycled frames kept per size class and thread
+static size_t prof_sample = 0;         // mean bytes between churn profiler samples, 0 disables
+static size_t watch_ns = 0;            // operations slower than this are logged, 0 disables
+static size_t watch_backtrace = 0;     // record backtraces of slow operations
+static size_t watch_signal = 0;        // signal that dumps the slow operation log to stderr, 0 for none
+static size_t async_release_min = 64 * 1024 * 1024; // mappings at least this large are unmapped in the background, 0 disables
+static size_t slab_max = SLAB_CLASSES * SLAB_QUANTUM; // largest object served from thread-owned slabs, 0 disables
+static size_t clone_min = 0;            // huge blocks at least this large are memfd-backed, 0 disables
+static size_t trace_fd = 0;             // descriptor the calls are recorded to, 0 disables
+
+typedef struct tunable {
+    const char* name;
+    size_t* value;
+} tunable_t;
+
+static tunable_t tunables[] = {
+    {"grow_step", &grow_step},
+    {"pregrow_low", &pregrow_low},
+    {"pregrow_step", &pregrow_step},
+    {"mmap_threshold", &mmap_threshold},
+    {"split_min", &split_min},
+    {"trim_threshold", &trim_threshold},
+    {"decay_ms", &decay_ms},
+    {"huge_cache_max", &huge_cache_max},
+    {"dontdump_min", &dontdump_min},
+    {"frame_cache", &frame_cache},
+    {"clone_min", &clone_min},
+    {"slab_max", &slab_max},
+    {"async_release_min", &async_release_min},
+    {"prof_sample", &prof_sample},
+    {"watch_ns", &watch_ns},
+    {"watch_backtrace", &watch_backtrace},
+    {"watch_signal", &watch_signal},
+    {"trace_fd", &trace_fd},
+};
+
+uint64_t watch_ticks(void) {
+    if (!watch_ns) return 0;
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// starts timing a phase, time later added to nested phases is left out of it
+uint64_t watch_start(void) {
+    return watch_ticks() - watch_op.claimed;
+}
+
+// adds the time since watch_start() to a phase of the current operation
+void watch_add(int phase, uint64_t since) {
+    if (!watch_ns || !watch_op.depth) return;
+    uint64_t spent = watch_ticks() - watch_op.claimed - since;
+    watch_op.phases[phase] += spent;
+    watch_op.claimed += spent;
+}
 
 // makes sure user-requested size is aligned to 8 bytes
 size_t aligned_size(size_t size) {
@@ -32,11 +424,34 @@ void set_footer(metadata_t* block) {
     footer->size = block->size;
 }
 
+// includes or excludes memory from core dumps; excluded ranges shrink to
+// whole pages inside the range while included ones grow to every page it
+// touches, so live data next to free memory is always dumped
+void set_dumpable(void* start, size_t len, int dump) {
+    uintptr_t lo = (uintptr_t)start, hi = lo + len;
+    if (dump) {
+        lo &= ~(uintptr_t)(PAGE - 1);
+        hi = (hi + PAGE - 1) & ~(uintptr_t)(PAGE - 1);
+    } else {
+        lo = (lo + PAGE - 1) & ~(uintptr_t)(PAGE - 1);
+        hi &= ~(uintptr_t)(PAGE - 1);
+    }
+    if (lo >= hi) return;
+    uint64_t since = watch_start();
+    madvise((void*)lo, hi - lo, dump ? MADV_DODUMP : MADV_DONTDUMP);
+    watch_add(PHASE_SYSCALL, since);
+}
+
+// whether free memory of this size is kept out of core dumps
+int is_nodump_size(size_t size) {
+    return dontdump_min && size >= dontdump_min;
+}
+
 // returns ptr if found, NULL otherwise
-metadata_t* find_free_block(size_t size) {
-    if (!free_list_head) return NULL;
+metadata_t* find_free_block(heap_t* heap, size_t size) {
+    if (!heap->free_list_head) return NULL;
 
-    metadata_t* curr = free_list_head;
+    metadata_t* curr = heap->free_list_head;
     while (curr) {
         if (curr->size >= size) return curr;
         curr = curr->next;
@@ -46,29 +461,29 @@ metadata_t* find_free_block(size_t size) {
 }
 
 // adds to free list and sets block->free = 1
-void add_to_free_list(metadata_t* block) {
+void add_to_free_list(heap_t* heap, metadata_t* block) {
     block->free = 1;
 
-    if (!free_list_head) {
-        free_list_head = block;
+    if (!heap->free_list_head) {
+        heap->free_list_head = block;
         block->next = NULL;
         block->prev = NULL;
         return;
     }
 
     block->prev = NULL;
-    block->next = free_list_head;
-    free_list_head->prev = block;
-    free_list_head = block;
+    block->next = heap->free_list_head;
+    heap->free_list_head->prev = block;
+    heap->free_list_head = block;
 }
 
 // removes from free list and sets block->free = 0
-void remove_from_free_list(metadata_t* block) {
-    metadata_t* curr = free_list_head;
+void remove_from_free_list(heap_t* heap, metadata_t* block) {
+    metadata_t* curr = heap->free_list_head;
     while (curr) {
         if (curr == block) {
             block->free = 0;
-            if (curr == free_list_head) free_list_head = curr->next;
+            if (curr == heap->free_list_head) heap->free_list_head = curr->next;
             // Ensure the doubly linked list is intact before writing to memory.
             // If P->next->prev != P or P->prev->next != P, the heap is corrupted.
             if (curr->next && curr->next->prev != curr) {
@@ -92,54 +507,111 @@ void remove_from_free_list(metadata_t* block) {
 }
 
 // check for coalesce (and do so if valid) with only the next adjacent block
-void coalesce_next(metadata_t* block) {
+void coalesce_next(heap_t* heap, metadata_t* block) {
     metadata_t* next_block = (void*)((char*)block + sizeof(metadata_t) + block->size + sizeof(footer_t));
-    if ((void*)next_block == heap_top) return;
+    if ((void*)next_block == heap->heap_top) return;
 
     if (next_block->free) {
-        remove_from_free_list(block);
-        remove_from_free_list(next_block);
+        remove_from_free_list(heap, block);
+        remove_from_free_list(heap, next_block);
 
         block->size = block->size + sizeof(footer_t) + sizeof(metadata_t) + next_block->size;
         set_footer(block);
 
-        add_to_free_list(block);
+        add_to_free_list(heap, block);
     }
 }
 
-// check for coalesce (and do so if valid) with only the prev adjacent block
-void coalesce_prev(metadata_t* block) {
-    if ((void*)block == heap_start) return;
+// check for coalesce (and do so if valid) with only the prev adjacent block,
+// returns the resulting block
+metadata_t* coalesce_prev(heap_t* heap, metadata_t* block) {
+    if ((void*)block == heap->heap_start) return block;
     footer_t* prev_footer = (footer_t*)((char*)block - sizeof(footer_t));
     size_t prev_size = prev_footer->size;
     metadata_t* prev_block = (void*)((char*)block - sizeof(footer_t) - prev_size - sizeof(metadata_t));
 
     if (prev_block->free) {
-        remove_from_free_list(block);
-        remove_from_free_list(prev_block);
+        remove_from_free_list(heap, block);
+        remove_from_free_list(heap, prev_block);
 
         prev_block->size = prev_block->size + sizeof(footer_t) + sizeof(metadata_t) + block->size;
         set_footer(prev_block);
 
-        add_to_free_list(prev_block);
+        add_to_free_list(heap, prev_block);
+        return prev_block;
     }
+    return block;
+}
+
+// returns the resulting block
+metadata_t* coalesce(heap_t* heap, metadata_t* block) {
+    coalesce_next(heap, block);
+    return coalesce_prev(heap, block);
+}
+
+// gives back the pages of a free block at the top of the main heap, the
+// break stays put so only its interior is released
+void heap_trim(metadata_t* block) {
+    char* lo = (char*)(((uintptr_t)(block + 1) + PAGE - 1) & ~(uintptr_t)(PAGE - 1));
+    char* hi = (char*)((uintptr_t)((char*)(block + 1) + block->size) & ~(uintptr_t)(PAGE - 1));
+    if (trim_mark && trim_mark < hi) hi = trim_mark;
+    if (lo >= hi) return;
+
+    uint64_t since = watch_start();
+    madvise(lo, hi - lo, MADV_DONTNEED);
+    watch_add(PHASE_SYSCALL, since);
+    trim_mark = lo;
+}
+
+// notes that a main heap block is in use again, so its pages are resident
+void trim_reuse(metadata_t* block) {
+    char* end = (char*)(block + 1) + block->size + sizeof(footer_t);
+    if (trim_mark && end > trim_mark) trim_mark = end;
 }
 
-void coalesce(metadata_t* block) {
-    coalesce_next(block);
-    coalesce_prev(block);
+// frees a heap block, large free blocks are left out of core dumps
+void heap_free(heap_t* heap, metadata_t* block) {
+    char* start = (char*)block;
+    char* end = (char*)(block + 1) + block->size + sizeof(footer_t);
+    size_t freed = block->size;
+
+    add_to_free_list(heap, block);
+    uint64_t since = watch_start();
+    coalesce_next(heap, block);
+    size_t next_part = block->size - freed;
+    metadata_t* merged = coalesce_prev(heap, block);
+    size_t prev_part = merged->size - block->size;
+    watch_add(PHASE_COALESCE, since);
+    if (trim_threshold && heap == &main_heap && merged->size >= trim_threshold
+        && (char*)(merged + 1) + merged->size + sizeof(footer_t) == (char*)heap->heap_top)
+        heap_trim(merged);
+    if (!is_nodump_size(merged->size)) return;
+
+    // large neighbours are excluded already, so only the pages the freed
+    // block touches and those of small neighbours need marking; this keeps
+    // a region growing one small free at a time from costing a syscall each
+    char* lo = is_nodump_size(prev_part) ? (char*)((uintptr_t)start & ~(uintptr_t)(PAGE - 1)) : (char*)(merged + 1);
+    char* hi = is_nodump_size(next_part) ? (char*)(((uintptr_t)end + PAGE - 1) & ~(uintptr_t)(PAGE - 1))
+                                         : (char*)(merged + 1) + merged->size;
+    if (lo < (char*)(merged + 1)) lo = (char*)(merged + 1);
+    if (hi > (char*)(merged + 1) + merged->size) hi = (char*)(merged + 1) + merged->size;
+    if (lo < hi) set_dumpable(lo, hi - lo, 0);
 }
 
-void split_block(metadata_t* block, size_t size) {
-    // check for at least 8 bytes of usable space
+void split_block(heap_t* heap, metadata_t* block, size_t size) {
+    // a large free block is excluded from core dumps, small ones never are
+    int nodump = is_nodump_size(block->size);
+
+    // check for at least split_min bytes of usable space
     size_t leftover = block->size - size;
-    if (leftover < sizeof(metadata_t) + sizeof(footer_t) + 8) {
-        remove_from_free_list(block);
+    if (leftover < sizeof(metadata_t) + sizeof(footer_t) + split_min) {
+        remove_from_free_list(heap, block);
         block->free = 0;
+        if (nodump) set_dumpable(block, sizeof(metadata_t) + block->size + sizeof(footer_t), 1);
         return;
     }
 
-    remove_from_free_list(block);
+    remove_from_free_list(heap, block);
     block->size = size;
     block->free = 0;
     set_footer(block);
@@ -147,205 +619,2698 @@ void split_block(metadata_t* block, size_t size) {
     metadata_t* new_block = (metadata_t*)((char*)block + sizeof(metadata_t) + block->size + sizeof(footer_t));
     new_block->size = leftover - sizeof(metadata_t) - sizeof(footer_t);
     new_block->free = 1;
+    new_block->kind = KIND_HEAP;
     new_block->next = NULL;
     new_block->prev = NULL;
     set_footer(new_block);
 
-    add_to_free_list(new_block);
+    add_to_free_list(heap, new_block);
 
-    coalesce_next(new_block);
+    // the remainder's header is dumped along with the allocated block, a
+    // remainder too small to stay excluded is dumped entirely
+    if (nodump && is_nodump_size(new_block->size))
+        set_dumpable(block, sizeof(metadata_t) + block->size + sizeof(footer_t) + sizeof(metadata_t), 1);
+    else if (nodump)
+        set_dumpable(block, sizeof(metadata_t) + block->size + sizeof(footer_t) + leftover, 1);
+
+    coalesce_next(heap, new_block);
 }
 
-/**
- * Allocate space for array in memory
- *
- * Allocates a block of memory for an array of num elements, each of them size
- * bytes long, and initializes all its bits to zero. The effective result is
- * the allocation of an zero-initialized memory block of (num * size) bytes.
- *
- * @param num
- *    Number of elements to be allocated.
- * @param size
- *    Size of elements.
- *
- * @return
- *    A pointer to the memory block allocated by the function.
- *
- *    The type of this pointer is always void*, which can be cast to the
- *    desired type of data pointer in order to be dereferenceable.
- *
- *    If the function failed to allocate the requested block of memory, a
- *    NULL pointer is returned.
- *
- * @see http://www.cplusplus.com/reference/clibrary/cstdlib/calloc/
- */
-void *calloc(size_t num, size_t size) {
-    // implement calloc!
-    if (num == 0 || size == 0) return NULL;
+// parses ALLOC_CONF, a comma separated list of name:value pairs where value
+// may carry a k, m or g suffix, e.g. "grow_step:1m,pregrow_low:4m"
+void parse_conf(const char* conf) {
+    while (conf && *conf) {
+        const char* colon = strchr(conf, ':');
+        if (!colon) break;
 
-    size_t total_size = num * size;
-    if (total_size / num != size) return NULL;
+        char* end;
+        size_t value = strtoull(colon + 1, &end, 0);
+        switch (*end) {
+            case 'k': case 'K': value <<= 10; end++; break;
+            case 'm': case 'M': value <<= 20; end++; break;
+            case 'g': case 'G': value <<= 30; end++; break;
+        }
 
-    void* ptr = malloc(total_size);
-    if (!ptr) return NULL;
+        size_t len = colon - conf;
+        size_t i;
+        for (i = 0; i < sizeof(tunables) / sizeof(tunables[0]); i++) {
+            if (strlen(tunables[i].name) == len && !strncmp(tunables[i].name, conf, len)) {
+                *tunables[i].value = value;
+                break;
+            }
+        }
+        if (i == sizeof(tunables) / sizeof(tunables[0]))
+            fprintf(stderr, "alloc: unknown ALLOC_CONF option '%.*s'\n", (int)len, conf);
 
-    memset(ptr, 0, total_size);
-    return ptr;
+        conf = *end == ',' ? end + 1 : NULL;
+    }
+
+    if (pregrow_low && !pregrow_step) pregrow_step = 2 * pregrow_low;
+    if (split_min < 8) split_min = 8;
+    if (slab_max > SLAB_CLASSES * SLAB_QUANTUM) slab_max = SLAB_CLASSES * SLAB_QUANTUM;
 }
 
-/**
- * Allocate memory block
- *
- * Allocates a block of size bytes of memory, returning a pointer to the
- * beginning of the block.  The content of the newly allocated block of
- * memory is not initialized, remaining with indeterminate values.
- *
- * @param size
- *    Size of the memory block, in bytes.
- *
- * @return
- *    On success, a pointer to the memory block allocated by the function.
- *
- *    The type of this pointer is always void*, which can be cast to the
- *    desired type of data pointer in order to be dereferenceable.
- *
- *    If the function failed to allocate the requested block of memory,
- *    a null pointer is returned.
- *
- * @see http://www.cplusplus.com/reference/clibrary/cstdlib/malloc/
- */
-void *malloc(size_t size) {
-    // implement malloc!
-    if (!size) return NULL;
+// prefaults [start, start + len) so first writes to it do not page fault
+static void prefault(void* start, size_t len) {
+    size_t page = getpagesize();
+    char* p = (char*)(((uintptr_t)start + page - 1) & ~(page - 1));
+    char* end = (char*)start + len;
+    if (p >= end) return;
+
+    if (!pregrow_touch && !madvise(p, end - p, MADV_POPULATE_WRITE)) return;
+    pregrow_touch = 1;
+    for (; p < end; p += page) *(volatile char*)p = 0;
+}
+
+// background thread that keeps the top reserve above pregrow_low so the
+// foreground rarely has to call sbrk or fault in fresh pages
+void* pregrow_thread(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&grow_lock);
+    while (1) {
+        while ((size_t)((char*)heap_break - (char*)main_heap.heap_top) >= pregrow_low)
+            pthread_cond_wait(&pregrow_cond, &grow_lock);
+
+        void* old_break = sbrk(pregrow_step);
+        if (old_break == (void*)-1) {
+            // out of memory, retry on the next foreground growth
+            pthread_cond_wait(&pregrow_cond, &grow_lock);
+            continue;
+        }
+
+        // the reserve is not live data until heap_grow hands it out
+        if (is_nodump_size(pregrow_step)) {
+            set_dumpable(old_break, pregrow_step, 0);
+            if (!nodump_mark) nodump_mark = old_break;
+            nodump_end = (char*)old_break + pregrow_step;
+        }
+
+        if (pregrow_touch) {
+            // touching is not safe once the foreground can hand the pages
+            // out, so fault them in before publishing the new break
+            prefault(old_break, pregrow_step);
+            heap_break = (char*)old_break + pregrow_step;
+            continue;
+        }
+
+        heap_break = (char*)old_break + pregrow_step;
+        pthread_mutex_unlock(&grow_lock);
+        prefault(old_break, pregrow_step);
+        pthread_mutex_lock(&grow_lock);
+    }
+    return NULL;
+}
+
+void pregrow_atfork_prepare(void) {
+    pthread_mutex_lock(&grow_lock);
+}
+
+void pregrow_atfork_parent(void) {
+    pthread_mutex_unlock(&grow_lock);
+}
+
+void pregrow_atfork_child(void) {
+    // the pre-growth thread does not survive fork
+    pthread_mutex_init(&grow_lock, NULL);
+    pthread_cond_init(&pregrow_cond, NULL);
+    pregrow_started = 0;
+}
+
+// starts the pre-growth thread, must not be called with grow_lock held since
+// pthread_create may call back into malloc
+void pregrow_start(void) {
+    pregrow_started = 1;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, pregrow_thread, NULL)) {
+        pthread_attr_destroy(&attr);
+        return;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_atfork(pregrow_atfork_prepare, pregrow_atfork_parent, pregrow_atfork_child);
+}
+
+void huge_cache_decay(uint64_t now);
+int huge_cache_drain(void);
+
+// unmaps queued mappings and, while the huge cache holds any, ages it so
+// cached mappings go once they are decay_ms old even if nothing calls malloc
+void* release_thread(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&release_lock);
+    while (1) {
+        while (!release_queue && !__atomic_load_n(&huge_cache_count, __ATOMIC_RELAXED))
+            pthread_cond_wait(&release_cond, &release_lock);
+        if (!release_queue) {
+            // wake at least twice per decay_ms, entries live under 1.5 times it
+            struct timespec until;
+            uint64_t wait_ms = decay_ms / 2 ? decay_ms / 2 : 1;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += wait_ms / 1000;
+            until.tv_nsec += (wait_ms % 1000) * 1000000;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&release_cond, &release_lock, &until);
+            if (release_queue) continue;
+
+            // huge_lock is taken before release_lock, which decaying needs
+            pthread_mutex_unlock(&release_lock);
+            pthread_mutex_lock(&huge_lock);
+            huge_cache_decay(now_ms());
+            pthread_mutex_unlock(&huge_lock);
+            pthread_mutex_lock(&release_lock);
+            continue;
+        }
+        release_t* release = release_queue;
+        release_queue = release->next;
+        if (!release_queue) release_queue_tail = NULL;
+        pthread_mutex_unlock(&release_lock);
+
+        // page table teardown and TLB shootdowns happen here instead of in free()
+        size_t len = release->len;
+        munmap(release, len);
+
+        pthread_mutex_lock(&release_lock);
+        release_pending -= len;
+        pthread_cond_broadcast(&release_done);
+    }
+    return NULL;
+}
+
+void release_atfork_prepare(void) {
+    pthread_mutex_lock(&huge_lock);
+    pthread_mutex_lock(&release_lock);
+}
+
+void release_atfork_parent(void) {
+    pthread_mutex_unlock(&release_lock);
+    pthread_mutex_unlock(&huge_lock);
+}
+
+void release_atfork_child(void) {
+    // the reclaimer thread does not survive fork, so the child unmaps the
+    // queue itself; a mapping the thread was in the middle of unmapping may
+    // be left behind, since its range could already be reused
+    pthread_mutex_init(&huge_lock, NULL);
+    pthread_mutex_init(&release_lock, NULL);
+    pthread_cond_init(&release_cond, NULL);
+    pthread_cond_init(&release_done, NULL);
+    release_started = 0;
+    while (release_queue) {
+        release_t* release = release_queue;
+        release_queue = release->next;
+        munmap(release, release->len);
+    }
+    release_queue_tail = NULL;
+    release_pending = 0;
+}
+
+void release_atfork_register(void) {
+    pthread_atfork(release_atfork_prepare, release_atfork_parent, release_atfork_child);
+}
+
+// starts the reclaimer thread if it is not running, must not be called with
+// release_lock held since pthread_create may call back into malloc
+void release_start(void) {
+    pthread_mutex_lock(&release_lock);
+    int start = !release_started;
+    release_started = 1;
+    pthread_cond_signal(&release_cond);
+    pthread_mutex_unlock(&release_lock);
+
+    if (start) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, release_thread, NULL)) {
+            // unmap the queue here, later releases try the thread again
+            pthread_mutex_lock(&release_lock);
+            release_started = 0;
+            while (release_queue) {
+                release_t* queued = release_queue;
+                release_queue = queued->next;
+                release_pending -= queued->len;
+                munmap(queued, queued->len);
+            }
+            release_queue_tail = NULL;
+            pthread_mutex_unlock(&release_lock);
+        } else {
+            static pthread_once_t once = PTHREAD_ONCE_INIT;
+            pthread_once(&once, release_atfork_register);
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+// unmaps a page-aligned mapping, in the background if it is large enough
+// that tearing it down would stall the caller
+void release_mapping(void* base, size_t len) {
+    if (!async_release_min || len < async_release_min) {
+        uint64_t since = watch_start();
+        munmap(base, len);
+        watch_add(PHASE_SYSCALL, since);
+        return;
+    }
+
+    release_t* release = base;
+    release->len = len;
+    release->next = NULL;
+
+    pthread_mutex_lock(&release_lock);
+    if (release_queue_tail) release_queue_tail->next = release;
+    else release_queue = release;
+    release_queue_tail = release;
+    release_pending += len;
+    pthread_mutex_unlock(&release_lock);
+    release_start();
+}
+
+// waits until queued mappings are unmapped, returns 0 if none were queued
+int release_wait(void) {
+    pthread_mutex_lock(&release_lock);
+    int pending = release_pending != 0;
+    while (release_pending) pthread_cond_wait(&release_done, &release_lock);
+    pthread_mutex_unlock(&release_lock);
+    return pending;
+}
+
+reclaim_t* reclaim_of(metadata_t* block) {
+    return (reclaim_t*)block - 1;
+}
+
+void reclaim_remove(metadata_t* block) {
+    if (block->prev) block->prev->next = block->next;
+    else reclaim_head = block->next;
+    if (block->next) block->next->prev = block->prev;
+    else reclaim_tail = block->prev;
+    block->next = NULL;
+    block->prev = NULL;
+}
+
+// discards the least recently unpinned blocks until at least bytes are
+// released, returns the number of bytes released
+size_t reclaim_unpinned(size_t bytes) {
+    size_t released = 0;
+    while (reclaim_head && released < bytes) {
+        metadata_t* block = reclaim_head;
+        reclaim_remove(block);
+        // keep the range reserved so the block can be pinned again, without
+        // committing memory to it, or at least drop its pages
+        if (mmap(block + 1, block->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0)
+            == MAP_FAILED)
+            madvise(block + 1, block->size, MADV_DONTNEED);
+        reclaim_of(block)->discarded = 1;
+        released += block->size;
+    }
+    return released;
+}
+
+// unmaps the huge cache and waits for queued releases, returns 0 if neither
+// held any memory
+int release_held(void) {
+    int cached = huge_cache_drain();
+    return release_wait() || cached;
+}
+
+// anonymous mapping, discarding unpinned reclaimable blocks to make room if
+// the first attempt fails
+void* map_anon(size_t len) {
+    uint64_t since = watch_start();
+    void* base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    // memory still held by the huge cache and queued releases comes back first
+    if (base == MAP_FAILED && release_held())
+        base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED && reclaim_unpinned(len))
+        base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    watch_add(PHASE_SYSCALL, since);
+    return base;
+}
+
+// extends heap by bytes, returns the start of the new space or NULL on failure
+void* heap_grow(heap_t* heap, size_t bytes) {
+    void* old_top = heap->heap_top;
+    if (heap->heap_end) {
+        // file-backed heaps grow inside their fixed mapping
+        if ((size_t)((char*)heap->heap_end - (char*)old_top) < bytes) return NULL;
+        heap->heap_top = (char*)old_top + bytes;
+        return old_top;
+    }
+
+    // take from the top reserve, moving the break in grow_step chunks
+    pthread_mutex_lock(&grow_lock);
+    size_t reserve = (char*)heap_break - (char*)old_top;
+    if (reserve < bytes) {
+        uint64_t since = watch_start();
+        size_t more = bytes - reserve;
+        size_t step = more < grow_step ? grow_step : more;
+        // fall back to the exact amount if a whole step does not fit, then
+        // to releasing the huge cache and queued releases and discarding
+        // reclaimable blocks
+        if (sbrk(step) == (void*)-1 && (step == more || sbrk(step = more) == (void*)-1)
+            && (!release_held() || sbrk(step) == (void*)-1)
+            && (!reclaim_unpinned(step) || sbrk(step) == (void*)-1)) {
+            pthread_mutex_unlock(&grow_lock);
+            watch_add(PHASE_SYSCALL, since);
+            return NULL; // sbrk failed
+        }
+        heap_break = (char*)heap_break + step;
+        watch_add(PHASE_SYSCALL, since);
+    }
+    heap->heap_top = (char*)old_top + bytes;
 
-    // initialize heap if needed
-    if (!heap_top) {
-        heap_start = sbrk(0);
-        heap_top = heap_start;
+    // space handed out from the excluded part of the reserve is dumped
+    // again, a grow_step ahead so small growths rarely take the syscall
+    char* dump_lo = NULL;
+    char* dump_hi = NULL;
+    if (nodump_mark && (char*)heap->heap_top > nodump_mark) {
+        dump_lo = nodump_mark;
+        dump_hi = (char*)heap->heap_top + grow_step;
+        if (dump_hi >= nodump_end) dump_hi = nodump_end;
+        nodump_mark = dump_hi == nodump_end ? NULL : dump_hi;
+        if (!nodump_mark) nodump_end = NULL;
     }
-    if (heap_top == (void*)-1) return NULL; // sbrk failed
 
+    int low = pregrow_low && (size_t)((char*)heap_break - (char*)heap->heap_top) < pregrow_low;
+    if (low) pthread_cond_signal(&pregrow_cond);
+    pthread_mutex_unlock(&grow_lock);
+
+    if (dump_lo) set_dumpable(dump_lo, dump_hi - dump_lo, 1);
+    if (low && !pregrow_started) pregrow_start();
+    return old_top;
+}
+
+// malloc from a specific heap
+void* heap_malloc(heap_t* heap, size_t size) {
     // full block size (aligned to 8 bytes)
     size_t full_size = aligned_size(size);
 
     // if free block exists with enough space use and split, else expand heap
-    metadata_t* new_block = find_free_block(full_size);
+    uint64_t since = watch_start();
+    metadata_t* new_block = find_free_block(heap, full_size);
+    watch_add(PHASE_SEARCH, since);
     if (new_block) {
-        split_block(new_block, full_size);
+        since = watch_start();
+        split_block(heap, new_block, full_size);
+        watch_add(PHASE_SPLIT, since);
     } else {
-        new_block = (metadata_t*)sbrk(full_size + sizeof(metadata_t) + sizeof(footer_t));
-        if ((void*)new_block == (void*)-1) return NULL; // sbrk failed
-        heap_top = sbrk(0);
+        new_block = heap_grow(heap, full_size + sizeof(metadata_t) + sizeof(footer_t));
+        if (!new_block) return NULL;
         new_block->size = full_size;
         new_block->free = 0;
+        new_block->kind = KIND_HEAP;
         new_block->next = NULL;
         new_block->prev = NULL;
         set_footer(new_block);
     }
+    if (heap == &main_heap) trim_reuse(new_block);
 
     return (void*)(new_block + 1);
 }
 
-/**
- * Deallocate space in memory
- *
- * A block of memory previously allocated using a call to malloc(),
- * calloc() or realloc() is deallocated, making it available again for
- * further allocations.
- *
- * Notice that this function leaves the value of ptr unchanged, hence
- * it still points to the same (now invalid) location, and not to the
- * null pointer.
- *
- * @param ptr
- *    Pointer to a memory block previously allocated with malloc(),
- *    calloc() or realloc() to be deallocated.  If a null pointer is
- *    passed as argument, no action occurs.
- */
-void free(void *ptr) {
-    // implement free!
-    if (!ptr) return;
-    metadata_t* block = ((metadata_t*)ptr) - 1;
-    add_to_free_list(block);
-    coalesce(block);
+// shrinks an allocated block to size, freeing the tail if it can hold a block
+void trim_block(heap_t* heap, metadata_t* block, size_t size) {
+    if (block->size < size) return;
+    size_t leftover = block->size - size;
+    if (leftover < sizeof(metadata_t) + sizeof(footer_t) + split_min) return;
+
+    block->size = size;
+    set_footer(block);
+
+    metadata_t* tail = (metadata_t*)((char*)block + sizeof(metadata_t) + block->size + sizeof(footer_t));
+    tail->size = leftover - sizeof(metadata_t) - sizeof(footer_t);
+    tail->kind = KIND_HEAP;
+    tail->next = NULL;
+    tail->prev = NULL;
+    set_footer(tail);
+
+    heap_free(heap, tail);
 }
 
-/**
- * Reallocate memory block
- *
- * The size of the memory block pointed to by the ptr parameter is changed
- * to the size bytes, expanding or reducing the amount of memory available
- * in the block.
- *
- * The function may move the memory block to a new location, in which case
- * the new location is returned. The content of the memory block is preserved
- * up to the lesser of the new and old sizes, even if the block is moved. If
- * the new size is larger, the value of the newly allocated portion is
- * indeterminate.
- *
- * In case that ptr is NULL, the function behaves exactly as malloc, assigning
- * a new block of size bytes and returning a pointer to the beginning of it.
+// grows an allocated block to at least size by merging the next block if it
+// is free, returns 1 on success
+int extend_in_place(heap_t* heap, metadata_t* block, size_t size) {
+    metadata_t* next = (metadata_t*)((char*)block + sizeof(metadata_t) + block->size + sizeof(footer_t));
+    if ((void*)next >= heap->heap_top || !next->free) return 0;
+
+    size_t combined = block->size + sizeof(metadata_t) + next->size + sizeof(footer_t);
+    if (combined < size) return 0;
+
+    remove_from_free_list(heap, next);
+    if (is_nodump_size(next->size)) set_dumpable(next, sizeof(metadata_t) + next->size + sizeof(footer_t), 1);
+    block->size = combined;
+    set_footer(block);
+    if (heap == &main_heap) trim_reuse(block);
+    return 1;
+}
+
+// malloc from a specific heap with the user pointer aligned to align, a
+// power of two
+void* heap_memalign(heap_t* heap, size_t align, size_t size) {
+    if (align <= 8) return heap_malloc(heap, size);
+
+    // room for the worst case gap, which must fit a free block of its own
+    size_t min_gap = sizeof(metadata_t) + sizeof(footer_t) + 8;
+    size_t padded = aligned_size(size) + align + min_gap;
+    if (padded < size) return NULL; // overflow
+    char* ptr = heap_malloc(heap, padded);
+    if (!ptr) return NULL;
+
+    metadata_t* block = (metadata_t*)ptr - 1;
+    char* user = (char*)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+    while (user != ptr && (size_t)(user - ptr) < min_gap) user += align;
+
+    if (user != ptr) {
+        // split the gap off the front and give it back
+        metadata_t* aligned = (metadata_t*)user - 1;
+        aligned->size = ptr + block->size - user;
+        aligned->free = 0;
+        aligned->kind = KIND_HEAP;
+        aligned->next = NULL;
+        aligned->prev = NULL;
+        set_footer(aligned);
+
+        block->size = (char*)aligned - sizeof(footer_t) - ptr;
+        set_footer(block);
+        heap_free(heap, block);
+        block = aligned;
+    }
+
+    trim_block(heap, block, aligned_size(size));
+    return (void*)(block + 1);
+}
+
+// returns the heap that owns block
+heap_t* heap_of(metadata_t* block) {
+    if (pheap && (void*)block >= pheap->heap.heap_start && (void*)block < pheap->heap.heap_top)
+        return &pheap->heap;
+    return &main_heap;
+}
+
+// shifts every pointer stored in a persistent heap by delta after it was
+// mapped at a different base than the one it was built at
+void pheap_relocate(pheap_header_t* header, ptrdiff_t delta) {
+#define RELOCATE(p) ((p) = (p) ? (void*)((char*)(p) + delta) : NULL)
+    RELOCATE(header->root);
+    RELOCATE(header->heap.free_list_head);
+    RELOCATE(header->heap.heap_start);
+    RELOCATE(header->heap.heap_top);
+    RELOCATE(header->heap.heap_end);
+
+    // walk every block via its size, only free blocks hold pointers
+    metadata_t* block = header->heap.heap_start;
+    while ((void*)block < header->heap.heap_top) {
+        if (block->free) {
+            RELOCATE(block->next);
+            RELOCATE(block->prev);
+        }
+        block = (metadata_t*)((char*)block + sizeof(metadata_t) + block->size + sizeof(footer_t));
+    }
+#undef RELOCATE
+}
+
+// pages a medium request needs, 0 if size is not served by the run engine
+size_t run_pages_for(size_t size) {
+    if (size < RUN_MIN || size > mmap_threshold) return 0;
+    size_t pages = (size + sizeof(metadata_t) + PAGE - 1) / PAGE;
+    return pages <= RUN_MAX_PAGES ? pages : 0;
+}
+
+run_chunk_t* run_chunk_of(void* ptr) {
+    return (run_chunk_t*)((uintptr_t)ptr & ~((uintptr_t)RUN_CHUNK_SIZE - 1));
+}
+
+void* run_page_addr(run_chunk_t* chunk, size_t page) {
+    return (char*)chunk + page * PAGE;
+}
+
+// records a run's length and state at its first and last page
+void run_set(run_chunk_t* chunk, size_t page, size_t pages, int state) {
+    chunk->pages[page] = chunk->pages[page + pages - 1] = pages;
+    chunk->state[page] = chunk->state[page + pages - 1] = state;
+}
+
+void run_bin_insert(run_chunk_t* chunk, size_t page) {
+    int state = chunk->state[page];
+    size_t pages = chunk->pages[page];
+    run_t* run = &chunk->runs[page];
+
+    run->prev = NULL;
+    run->next = run_bins[state][pages];
+    if (run->next) run->next->prev = run;
+    run_bins[state][pages] = run;
+    run_bin_map[state][pages / 64] |= 1ULL << (pages % 64);
+}
+
+void run_bin_remove(run_chunk_t* chunk, size_t page) {
+    int state = chunk->state[page];
+    size_t pages = chunk->pages[page];
+    run_t* run = &chunk->runs[page];
+
+    if (run->prev) run->prev->next = run->next;
+    else run_bins[state][pages] = run->next;
+    if (run->next) run->next->prev = run->prev;
+    if (!run_bins[state][pages]) run_bin_map[state][pages / 64] &= ~(1ULL << (pages % 64));
+}
+
+// best fit: the smallest free run of the given state with at least pages pages
+run_t* run_find(int state, size_t pages) {
+    size_t word = pages / 64;
+    uint64_t bits = run_bin_map[state][word] & (~0ULL << (pages % 64));
+    while (!bits) {
+        if (++word == RUN_CHUNK_PAGES / 64) return NULL;
+        bits = run_bin_map[state][word];
+    }
+    return run_bins[state][word * 64 + __builtin_ctzll(bits)];
+}
+
+// dirty runs only merge with dirty runs, purged and zeroed runs merge into purged
+int run_mergeable(int a, int b) {
+    return a != RUN_ALLOCATED && b != RUN_ALLOCATED && (a == RUN_DIRTY) == (b == RUN_DIRTY);
+}
+
+// merges a free run (not yet binned) with its neighbours and bins the
+// result; a free run is either entirely excluded from core dumps or not at
+// all, large runs and runs merged with an excluded one are excluded
+void run_coalesce(run_chunk_t* chunk, size_t page) {
+    size_t pages = chunk->pages[page];
+    int state = chunk->state[page];
+    uint64_t dirtied = chunk->runs[page].dirtied;
+
+    // the parts being merged, at most three
+    size_t part_page[3], part_pages[3];
+    int part_nodump[3], parts = 0, nodump = 0, i;
+    part_page[parts] = page;
+    part_pages[parts] = pages;
+    part_nodump[parts++] = chunk->runs[page].nodump;
+
+    size_t next = page + pages;
+    if (next < RUN_CHUNK_PAGES && run_mergeable(state, chunk->state[next])) {
+        if (chunk->state[next] != state) state = RUN_PURGED;
+        part_page[parts] = next;
+        part_pages[parts] = chunk->pages[next];
+        part_nodump[parts++] = chunk->runs[next].nodump;
+        run_bin_remove(chunk, next);
+        pages += chunk->pages[next];
+    }
+
+    if (page > RUN_HEADER_PAGES && run_mergeable(state, chunk->state[page - 1])) {
+        size_t prev = page - chunk->pages[page - 1];
+        if (chunk->state[prev] != state) state = RUN_PURGED;
+        part_page[parts] = prev;
+        part_pages[parts] = chunk->pages[prev];
+        part_nodump[parts++] = chunk->runs[prev].nodump;
+        run_bin_remove(chunk, prev);
+        pages += chunk->pages[prev];
+        page = prev;
+    }
+
+    for (i = 0; i < parts; i++) nodump |= part_nodump[i];
+    if (nodump || is_nodump_size(pages * PAGE)) {
+        for (i = 0; i < parts; i++) {
+            if (!part_nodump[i]) set_dumpable(run_page_addr(chunk, part_page[i]), part_pages[i] * PAGE, 0);
+        }
+        nodump = 1;
+    }
+
+    run_set(chunk, page, pages, state);
+    chunk->runs[page].dirtied = dirtied;
+    chunk->runs[page].nodump = nodump;
+    run_bin_insert(chunk, page);
+}
+
+run_chunk_t* run_chunk_new(void) {
+    // over-map so the chunk can be aligned to its size
+    char* raw = map_anon(2 * RUN_CHUNK_SIZE);
+    if (raw == MAP_FAILED) return NULL;
+    run_chunk_t* chunk = run_chunk_of(raw + RUN_CHUNK_SIZE - 1);
+    uint64_t since = watch_start();
+    if ((char*)chunk > raw) munmap(raw, (char*)chunk - raw);
+    munmap((char*)chunk + RUN_CHUNK_SIZE, raw + RUN_CHUNK_SIZE - (char*)chunk);
+    watch_add(PHASE_SYSCALL, since);
+
+    chunk->free_pages = RUN_MAX_PAGES;
+    run_set(chunk, RUN_HEADER_PAGES, RUN_MAX_PAGES, RUN_ZEROED);
+    chunk->runs[RUN_HEADER_PAGES].nodump = is_nodump_size(RUN_MAX_PAGES * PAGE);
+    if (chunk->runs[RUN_HEADER_PAGES].nodump)
+        set_dumpable(run_page_addr(chunk, RUN_HEADER_PAGES), RUN_MAX_PAGES * PAGE, 0);
+    run_bin_insert(chunk, RUN_HEADER_PAGES);
+    run_chunks++;
+    return chunk;
+}
+
+// unbins every free run of an entirely free chunk and unmaps it
+void run_chunk_release(run_chunk_t* chunk) {
+    size_t page;
+    for (page = RUN_HEADER_PAGES; page < RUN_CHUNK_PAGES; page += chunk->pages[page])
+        run_bin_remove(chunk, page);
+    uint64_t since = watch_start();
+    munmap(chunk, RUN_CHUNK_SIZE);
+    watch_add(PHASE_SYSCALL, since);
+    run_chunks--;
+}
+
+// purges the dirty runs of one length that are older than decay_ms
+void run_purge_bin(size_t pages, uint64_t now) {
+    run_t* run = run_bins[RUN_DIRTY][pages];
+    while (run) {
+        run_t* next = run->next;
+        if (run->dirtied + decay_ms <= now) {
+            run_chunk_t* chunk = run_chunk_of(run);
+            size_t page = run - chunk->runs;
+            run_bin_remove(chunk, page);
+            uint64_t since = watch_start();
+            madvise(run_page_addr(chunk, page), pages * PAGE, MADV_DONTNEED);
+            watch_add(PHASE_SYSCALL, since);
+            run_set(chunk, page, pages, RUN_PURGED);
+            run_coalesce(chunk, page);
+        }
+        run = next;
+    }
+}
+
+// returns dirty runs older than decay_ms to the OS
+void run_purge(uint64_t now) {
+    run_last_purge = now;
+
+    size_t word;
+    for (word = 0; word < RUN_CHUNK_PAGES / 64; word++) {
+        uint64_t bits = run_bin_map[RUN_DIRTY][word];
+        while (bits) {
+            run_purge_bin(word * 64 + __builtin_ctzll(bits), now);
+            bits &= bits - 1;
+        }
+    }
+}
+
+// allocates a run of pages pages, *zeroed tells whether its contents are zero
+void* run_alloc(size_t pages, int* zeroed) {
+    // prefer resident pages, unless the caller wants zeroed memory
+    static const int normal_order[] = {RUN_DIRTY, RUN_PURGED, RUN_ZEROED};
+    static const int zero_order[] = {RUN_ZEROED, RUN_PURGED, RUN_DIRTY};
+    const int* order = *zeroed ? zero_order : normal_order;
+
+    run_t* run = NULL;
+    int i;
+    uint64_t since = watch_start();
+    for (i = 0; i < 3 && !run; i++) run = run_find(order[i], pages);
+    watch_add(PHASE_SEARCH, since);
+    if (!run) {
+        run_chunk_t* chunk = run_chunk_new();
+        if (!chunk) return NULL;
+        run = &chunk->runs[RUN_HEADER_PAGES];
+    }
+
+    run_chunk_t* chunk = run_chunk_of(run);
+    size_t page = run - chunk->runs;
+    size_t run_pages = chunk->pages[page];
+    int state = chunk->state[page];
+    run_bin_remove(chunk, page);
+
+    // the tail stays free in the same state
+    if (run_pages > pages) {
+        run_set(chunk, page + pages, run_pages - pages, state);
+        chunk->runs[page + pages].dirtied = run->dirtied;
+        chunk->runs[page + pages].nodump = run->nodump;
+        run_bin_insert(chunk, page + pages);
+    }
+    run_set(chunk, page, pages, RUN_ALLOCATED);
+    chunk->free_pages -= pages;
+    if (run->nodump) set_dumpable(run_page_addr(chunk, page), pages * PAGE, 1);
+
+    *zeroed = state != RUN_DIRTY;
+    return run_page_addr(chunk, page);
+}
+
+void run_free(void* ptr) {
+    run_chunk_t* chunk = run_chunk_of(ptr);
+    size_t page = ((char*)ptr - (char*)chunk) / PAGE;
+    size_t pages = chunk->pages[page];
+    uint64_t now = now_ms();
+
+    chunk->free_pages += pages;
+    run_set(chunk, page, pages, RUN_DIRTY);
+    chunk->runs[page].dirtied = now;
+    chunk->runs[page].nodump = 0;
+    run_coalesce(chunk, page);
+
+    // keep one chunk around so alternating malloc/free does not thrash mmap
+    if (chunk->free_pages == RUN_MAX_PAGES && run_chunks > 1) run_chunk_release(chunk);
+
+    if (now >= run_last_purge + decay_ms) run_purge(now);
+}
+
+// medium allocation, zero requests zeroed memory
+void* run_malloc(size_t size, int zero) {
+    size_t pages = run_pages_for(size);
+    int zeroed = zero;
+    metadata_t* block = run_alloc(pages, &zeroed);
+    if (!block) return NULL;
+    if (zero && !zeroed) {
+        uint64_t since = watch_start();
+        memset(block, 0, pages * PAGE);
+        watch_add(PHASE_ZERO, since);
+    }
+
+    block->size = pages * PAGE - sizeof(metadata_t);
+    block->free = 0;
+    block->kind = KIND_RUN;
+    return (void*)(block + 1);
+}
+
+size_t huge_map_size(size_t size) {
+    size_t map_size = PAGE + ((size + PAGE - 1) & ~((size_t)PAGE - 1));
+    return map_size < size ? 0 : map_size; // 0 on overflow
+}
+
+void huge_cache_remove(size_t i) {
+    huge_cache_bytes -= huge_cache[i].map_size;
+    huge_cache_count--;
+    memmove(&huge_cache[i], &huge_cache[i + 1], (huge_cache_count - i) * sizeof(huge_cached_t));
+}
+
+// unmaps cached mappings older than decay_ms
+void huge_cache_decay(uint64_t now) {
+    while (huge_cache_count && huge_cache[0].freed + decay_ms <= now) {
+        release_mapping(huge_cache[0].base, huge_cache[0].map_size);
+        huge_cache_remove(0);
+    }
+}
+
+// unmaps every cached mapping, returns 0 if the cache was empty
+int huge_cache_drain(void) {
+    pthread_mutex_lock(&huge_lock);
+    int cached = huge_cache_count != 0;
+    while (huge_cache_count) {
+        release_mapping(huge_cache[0].base, huge_cache[0].map_size);
+        huge_cache_remove(0);
+    }
+    pthread_mutex_unlock(&huge_lock);
+    return cached;
+}
+
+// takes at least map_size bytes from the cache, returns NULL if no cached
+// mapping is close enough in size and sets *map_size to what was taken
+void* huge_cache_take(size_t* map_size) {
+    // smallest mapping that fits, whole unless it is more than twice as big
+    size_t i, best = huge_cache_count;
+    for (i = 0; i < huge_cache_count; i++) {
+        size_t cached = huge_cache[i].map_size;
+        if (cached >= *map_size && (best == huge_cache_count || cached < huge_cache[best].map_size))
+            best = i;
+    }
+    if (best < huge_cache_count) {
+        char* base = huge_cache[best].base;
+        if (huge_cache[best].map_size <= 2 * *map_size) {
+            *map_size = huge_cache[best].map_size;
+            huge_cache_remove(best);
+        } else {
+            // the tail stays cached
+            huge_cache[best].base = base + *map_size;
+            huge_cache[best].map_size -= *map_size;
+            huge_cache_bytes -= *map_size;
+        }
+        return base;
+    }
+
+    // otherwise the largest one that is at least half as big, grown in place
+    for (i = 0; i < huge_cache_count; i++) {
+        size_t cached = huge_cache[i].map_size;
+        if (cached >= *map_size / 2 && (best == huge_cache_count || cached > huge_cache[best].map_size))
+            best = i;
+    }
+    if (best == huge_cache_count) return NULL;
+
+    void* base = huge_cache[best].base;
+    size_t cached = huge_cache[best].map_size;
+    huge_cache_remove(best);
+
+    // moving page tables is still cheaper than faulting in a new mapping
+    uint64_t since = watch_start();
+    void* moved = mremap(base, cached, *map_size, MREMAP_MAYMOVE);
+    watch_add(PHASE_SYSCALL, since);
+    if (moved == MAP_FAILED) {
+        release_mapping(base, cached);
+        return NULL;
+    }
+    return moved;
+}
+
+void huge_cache_put(void* base, size_t map_size) {
+    // frees age the cache too, so it drains once huge mallocs stop
+    uint64_t now = now_ms();
+    huge_cache_decay(now);
+    if (map_size > huge_cache_max) {
+        release_mapping(base, map_size);
+        return;
+    }
+    while (huge_cache_count == HUGE_CACHE_SLOTS || huge_cache_bytes + map_size > huge_cache_max) {
+        release_mapping(huge_cache[0].base, huge_cache[0].map_size);
+        huge_cache_remove(0);
+    }
+
+    if (is_nodump_size(map_size)) set_dumpable(base, map_size, 0);
+    huge_cache[huge_cache_count].base = base;
+    huge_cache[huge_cache_count].map_size = map_size;
+    huge_cache[huge_cache_count].freed = now;
+    huge_cache_count++;
+    huge_cache_bytes += map_size;
+}
+
+clone_file_t** clone_file_of(metadata_t* block) {
+    return (clone_file_t**)block - 1;
+}
+
+clone_file_t* clone_file_new(size_t map_size) {
+    clone_file_t* file = malloc(sizeof(clone_file_t));
+    if (!file) return NULL;
+    file->fd = memfd_create("alloc", MFD_CLOEXEC);
+    if (file->fd < 0 || ftruncate(file->fd, map_size) < 0) {
+        if (file->fd >= 0) close(file->fd);
+        free(file);
+        return NULL;
+    }
+    file->refs = 0;
+    file->shared = NULL;
+    file->next = NULL;
+    return file;
+}
+
+void clone_file_unref(clone_file_t* file) {
+    if (--file->refs) return;
+    close(file->fd);
+    free(file);
+}
+
+// a file whose freeze failed before fork is already off the list, though
+// its block is still a shared mapping
+void shared_files_remove(clone_file_t* file) {
+    clone_file_t** link = &shared_files;
+    while (*link && *link != file) link = &(*link)->next;
+    if (*link) *link = file->next;
+    file->shared = NULL;
+}
+
+// turns a memfd block into a copy-on-write view of its file, which is never
+// written through again; returns 0 on success
+int clone_freeze(metadata_t* block) {
+    clone_file_t* file = *clone_file_of(block);
+    size_t map_size = block->size + PAGE;
+    // the page cache holds the data, so remapping it copies nothing
+    if (mmap((char*)(block + 1) - PAGE, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, file->fd, 0)
+        == MAP_FAILED)
+        return -1;
+    shared_files_remove(file);
+    block->kind = KIND_COW;
+    return 0;
+}
+
+// a shared mapping would stay shared with the child, so freeze them all
+void clone_atfork_prepare(void) {
+    while (shared_files) {
+        if (clone_freeze(shared_files->shared)) shared_files_remove(shared_files);
+    }
+}
+
+void clone_atfork_register(void) {
+    pthread_atfork(clone_atfork_prepare, NULL, NULL);
+}
+
+// huge allocation backed by a memfd so malloc_clone can share its pages,
+// returns NULL if memfd_create is not available
+void* memfd_malloc(size_t map_size) {
+    clone_file_t* file = clone_file_new(map_size);
+    if (!file) return NULL;
+    char* base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (base == MAP_FAILED) {
+        close(file->fd);
+        free(file);
+        return NULL;
+    }
+    pthread_once(&clone_once, clone_atfork_register);
+
+    metadata_t* block = (metadata_t*)(base + PAGE) - 1;
+    block->size = map_size - PAGE;
+    block->free = 0;
+    block->kind = KIND_MEMFD;
+    *clone_file_of(block) = file;
+    file->refs = 1;
+    file->shared = block;
+    file->next = shared_files;
+    shared_files = file;
+    return (void*)(block + 1);
+}
+
+// copies the pages src has written since it became a copy-on-write view,
+// which are the anonymous ones in its mapping, or all of them if
+// /proc/self/pagemap is unreadable
+void clone_copy_dirty(char* dst, const char* src, size_t map_size) {
+    size_t pages = map_size / PAGE;
+    int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    uint64_t entries[512];
+    size_t i, j;
+
+    for (i = 0; i < pages; i += 512) {
+        size_t n = pages - i < 512 ? pages - i : 512;
+        off_t offset = (off_t)((uintptr_t)src / PAGE + i) * sizeof(uint64_t);
+        if (fd < 0 || pread(fd, entries, n * sizeof(uint64_t), offset) != (ssize_t)(n * sizeof(uint64_t))) {
+            memcpy(dst + i * PAGE, src + i * PAGE, map_size - i * PAGE);
+            break;
+        }
+        for (j = 0; j < n; j++) {
+            // present and not a file page, or swapped out
+            int present = (entries[j] >> 63) & 1, swapped = (entries[j] >> 62) & 1, file = (entries[j] >> 61) & 1;
+            if ((present && !file) || swapped) memcpy(dst + (i + j) * PAGE, src + (i + j) * PAGE, PAGE);
+        }
+    }
+    if (fd >= 0) close(fd);
+}
+
+// copy-on-write clone of a huge block, returns NULL if it has to be copied
+void* huge_clone(metadata_t* block) {
+    char* src = (char*)(block + 1) - PAGE;
+    size_t map_size = block->size + PAGE;
+    int dirty = block->kind == KIND_COW;
+
+    if (block->kind == KIND_HUGE) {
+        // anonymous pages cannot be shared, so move them into a file once
+        clone_file_t* file = clone_file_new(map_size);
+        if (!file) return NULL;
+        size_t done = 0;
+        while (done < map_size) {
+            ssize_t n = pwrite(file->fd, src + done, map_size - done, done);
+            if (n <= 0) {
+                close(file->fd);
+                free(file);
+                return NULL;
+            }
+            done += n;
+        }
+        if (mmap(src, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, file->fd, 0) == MAP_FAILED) {
+            close(file->fd);
+            free(file);
+            return NULL;
+        }
+        block->kind = KIND_COW;
+        *clone_file_of(block) = file;
+        file->refs = 1;
+    } else if (block->kind == KIND_MEMFD && clone_freeze(block)) {
+        return NULL;
+    }
+
+    clone_file_t* file = *clone_file_of(block);
+    char* base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file->fd, 0);
+    if (base == MAP_FAILED) return NULL;
+    if (dirty) clone_copy_dirty(base, src, map_size);
+    file->refs++;
+
+    metadata_t* clone = (metadata_t*)(base + PAGE) - 1;
+    clone->size = block->size;
+    clone->free = 0;
+    clone->kind = KIND_COW;
+    *clone_file_of(clone) = file;
+    return (void*)(clone + 1);
+}
+
+void reclaim_free(metadata_t* block) {
+    reclaim_t* reclaim = reclaim_of(block);
+    if (!reclaim->pins && !reclaim->discarded) reclaim_remove(block);
+    release_mapping((char*)(block + 1) - reclaim->header, reclaim->header + block->size);
+}
+
+void clone_free(metadata_t* block) {
+    clone_file_t* file = *clone_file_of(block);
+    if (block->kind == KIND_MEMFD) shared_files_remove(file);
+    release_mapping((char*)(block + 1) - PAGE, block->size + PAGE);
+    clone_file_unref(file);
+}
+
+// large allocation in its own mapping, the header sits at the end of a
+// leading page so user memory is page-aligned; zero requests zeroed memory
+void* huge_malloc(size_t size, int zero) {
+    size_t map_size = huge_map_size(size);
+    if (!map_size) return NULL;
+
+    // fresh files are already zeroed
+    if (clone_min && size >= clone_min) {
+        uint64_t since = watch_start();
+        void* ptr = memfd_malloc(map_size);
+        watch_add(PHASE_SYSCALL, since);
+        if (ptr) return ptr;
+    }
+
+    pthread_mutex_lock(&huge_lock);
+    huge_cache_decay(now_ms());
+    char* base = huge_cache_take(&map_size);
+    pthread_mutex_unlock(&huge_lock);
+    if (base) {
+        // cached mappings may have been excluded from core dumps
+        if (dontdump_min) set_dumpable(base, map_size, 1);
+        // dropping the pages is cheaper than clearing them
+        if (zero) {
+            uint64_t since = watch_start();
+            madvise(base, map_size, MADV_DONTNEED);
+            watch_add(PHASE_SYSCALL, since);
+        }
+    } else {
+        // fresh mappings are already zeroed
+        base = map_anon(map_size);
+        if (base == MAP_FAILED) return NULL;
+    }
+
+    metadata_t* block = (metadata_t*)(base + PAGE) - 1;
+    block->size = map_size - PAGE;
+    block->free = 0;
+    block->kind = KIND_HUGE;
+    return (void*)(block + 1);
+}
+
+void huge_free(metadata_t* block) {
+    pthread_mutex_lock(&huge_lock);
+    int was_empty = !huge_cache_count;
+    huge_cache_put((char*)(block + 1) - PAGE, block->size + PAGE);
+    int kick = was_empty && huge_cache_count;
+    pthread_mutex_unlock(&huge_lock);
+    // cached mappings are aged in the background, the reclaimer thread only
+    // needs waking when the cache stops being empty
+    if (kick) release_start();
+}
+
+// resizes a huge or memfd block with mremap, which moves page tables
+// instead of data
+void* huge_realloc(metadata_t* block, size_t size) {
+    size_t map_size = huge_map_size(size);
+    if (!map_size) return NULL;
+
+    // a memfd block's file has to cover its whole mapping
+    clone_file_t* file = block->kind == KIND_MEMFD ? *clone_file_of(block) : NULL;
+    if (file && map_size > block->size + PAGE && ftruncate(file->fd, map_size) < 0) return NULL;
+    uint64_t since = watch_start();
+    char* base = mremap((char*)(block + 1) - PAGE, block->size + PAGE, map_size, MREMAP_MAYMOVE);
+    watch_add(PHASE_SYSCALL, since);
+    if (base == MAP_FAILED) return NULL;
+
+    block = (metadata_t*)(base + PAGE) - 1;
+    if (file) {
+        if (map_size < block->size + PAGE) ftruncate(file->fd, map_size);
+        file->shared = block;
+    }
+    block->size = map_size - PAGE;
+    return (void*)(block + 1);
+}
+
+// returns the slab holding ptr, or NULL if ptr is not a slab object
+slab_t* slab_of(void* ptr) {
+    if ((uintptr_t)((char*)ptr - slab_region) >= __atomic_load_n(&slab_region_used, __ATOMIC_ACQUIRE)) return NULL;
+    return (slab_t*)((uintptr_t)ptr & ~((uintptr_t)SLAB_SIZE - 1));
+}
+
+// partial and full slabs are kept in rings, appended at the tail
+void slab_ring_push(slab_t** head, slab_t* slab, int state) {
+    slab->state = state;
+    if (!*head) {
+        slab->next = slab;
+        slab->prev = slab;
+        *head = slab;
+        return;
+    }
+    slab->next = *head;
+    slab->prev = (*head)->prev;
+    slab->prev->next = slab;
+    (*head)->prev = slab;
+}
+
+void slab_ring_remove(slab_t** head, slab_t* slab) {
+    if (slab->next == slab) {
+        *head = NULL;
+        return;
+    }
+    slab->prev->next = slab->next;
+    slab->next->prev = slab->prev;
+    if (*head == slab) *head = slab->next;
+}
+
+// moves objects other threads freed to the owner's free list
+void slab_collect(slab_t* slab) {
+    void* obj = __atomic_exchange_n(&slab->remote, NULL, __ATOMIC_ACQUIRE);
+    while (obj) {
+        void* next = *(void**)obj;
+        *(void**)obj = slab->free_list;
+        slab->free_list = obj;
+        slab->live--;
+        obj = next;
+    }
+}
+
+// gives a slab without live objects back for reuse by any thread and class
+void slab_release(slab_t* slab) {
+    __atomic_store_n(&slab->owner, NULL, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&slab_lock);
+    slab->next = slab_unused;
+    slab_unused = slab;
+    pthread_mutex_unlock(&slab_lock);
+}
+
+void slab_init(slab_t* slab, slab_cache_t* cache, int class) {
+    slab->owner = cache;
+    slab->free_list = NULL;
+    slab->bump = (char*)slab + SLAB_HEADER;
+    slab->size = (size_t)(class + 1) * SLAB_QUANTUM;
+    slab->live = 0;
+    slab->class = class;
+    slab->remote = NULL;
+}
+
+// a slab to allocate from once cache's current slab of class is exhausted,
+// NULL if the region is used up
+slab_t* slab_refill(slab_cache_t* cache, int class) {
+    slab_t* slab = cache->current[class];
+    if (slab) slab_ring_push(&cache->full[class], slab, SLAB_FULL);
+    cache->current[class] = NULL;
+
+    // own slabs with objects freed locally, then by other threads
+    slab = cache->partial[class];
+    if (slab) {
+        slab_ring_remove(&cache->partial[class], slab);
+    } else {
+        int i;
+        for (i = 0; i < SLAB_SCAN && cache->full[class]; i++) {
+            slab_t* candidate = cache->full[class];
+            if (__atomic_load_n(&candidate->remote, __ATOMIC_RELAXED)) {
+                slab_ring_remove(&cache->full[class], candidate);
+                slab = candidate;
+                break;
+            }
+            // rotate so the next refill checks other slabs
+            cache->full[class] = candidate->next;
+        }
+    }
+
+    if (!slab) {
+        pthread_mutex_lock(&slab_lock);
+        slab = slab_orphans[class];
+        if (slab) {
+            slab_orphans[class] = slab->next;
+            __atomic_store_n(&slab->owner, cache, __ATOMIC_RELEASE);
+        } else if ((slab = slab_unused)) {
+            slab_unused = slab->next;
+            slab_init(slab, cache, class);
+        } else if (slab_region_used < SLAB_REGION_SIZE
+                   && !mprotect(slab_region + slab_region_used, SLAB_SIZE, PROT_READ | PROT_WRITE)) {
+            slab = (slab_t*)(slab_region + slab_region_used);
+            slab_init(slab, cache, class);
+            __atomic_store_n(&slab_region_used, slab_region_used + SLAB_SIZE, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&slab_lock);
+        if (!slab) return NULL;
+    }
+
+    slab->state = SLAB_CURRENT;
+    cache->current[class] = slab;
+    return slab;
+}
+
+// hands an exiting thread's slabs to whichever thread next needs their class
+void slab_cache_destroy(void* arg) {
+    slab_cache_t* cache = arg;
+    int class;
+    slab_cache = NULL;
+    pthread_mutex_lock(&slab_lock);
+    for (class = 0; class < SLAB_CLASSES; class++) {
+        if (cache->current[class]) slab_ring_push(&cache->full[class], cache->current[class], SLAB_FULL);
+        slab_t** rings[2] = {&cache->partial[class], &cache->full[class]};
+        int i;
+        for (i = 0; i < 2; i++) {
+            while (*rings[i]) {
+                slab_t* slab = *rings[i];
+                slab_ring_remove(rings[i], slab);
+                __atomic_store_n(&slab->owner, NULL, __ATOMIC_RELEASE);
+                slab->state = SLAB_ORPHAN;
+                slab->next = slab_orphans[class];
+                slab_orphans[class] = slab;
+            }
+        }
+    }
+    pthread_mutex_unlock(&slab_lock);
+    munmap(cache, sizeof(slab_cache_t));
+}
+
+void slab_atfork_child(void) {
+    pthread_mutex_init(&slab_lock, NULL);
+}
+
+void slab_setup(void) {
+    // reserve the region aligned to the slab size, slabs are enabled one at a time
+    char* raw = mmap(NULL, SLAB_REGION_SIZE + SLAB_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) return;
+    char* region = (char*)(((uintptr_t)raw + SLAB_SIZE - 1) & ~((uintptr_t)SLAB_SIZE - 1));
+    if (region > raw) munmap(raw, region - raw);
+    munmap(region + SLAB_REGION_SIZE, raw + SLAB_SIZE - region);
+    pthread_key_create(&slab_key, slab_cache_destroy);
+    pthread_atfork(NULL, NULL, slab_atfork_child);
+    slab_region = region;
+}
+
+// small allocation from the calling thread's slabs, NULL if none are left
+void* slab_malloc(size_t size) {
+    slab_cache_t* cache = slab_cache;
+    if (!cache) {
+        pthread_once(&slab_once, slab_setup);
+        if (!slab_region) return NULL;
+        cache = mmap(NULL, sizeof(slab_cache_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (cache == MAP_FAILED) return NULL;
+        pthread_setspecific(slab_key, cache);
+        slab_cache = cache;
+    }
+
+    int class = (int)((size - 1) / SLAB_QUANTUM);
+    slab_t* slab = cache->current[class];
+    if (!slab) slab = slab_refill(cache, class);
+
+    while (slab) {
+        void* obj = slab->free_list;
+        if (obj) {
+            slab->free_list = *(void**)obj;
+        } else if (slab->bump + slab->size <= (char*)slab + SLAB_SIZE) {
+            obj = slab->bump;
+            slab->bump += slab->size;
+        } else if (__atomic_load_n(&slab->remote, __ATOMIC_RELAXED)) {
+            slab_collect(slab);
+            continue;
+        } else {
+            slab = slab_refill(cache, class);
+            continue;
+        }
+        slab->live++;
+        return obj;
+    }
+    return NULL;
+}
+
+void slab_free(slab_t* slab, void* ptr) {
+    slab_cache_t* cache = slab_cache;
+    if (!cache || __atomic_load_n(&slab->owner, __ATOMIC_ACQUIRE) != cache) {
+        // the owner collects it when it runs out of objects
+        void* head = __atomic_load_n(&slab->remote, __ATOMIC_RELAXED);
+        do {
+            *(void**)ptr = head;
+        } while (!__atomic_compare_exchange_n(&slab->remote, &head, ptr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->live--;
+    if (slab->state == SLAB_CURRENT) return;
+
+    slab_t** ring = slab->state == SLAB_PARTIAL ? &cache->partial[slab->class] : &cache->full[slab->class];
+    if (!slab->live) {
+        // objects freed by other threads still count as live, so none are left
+        slab_ring_remove(ring, slab);
+        slab_release(slab);
+    } else if (slab->state == SLAB_FULL) {
+        slab_ring_remove(ring, slab);
+        slab_ring_push(&cache->partial[slab->class], slab, SLAB_PARTIAL);
+    }
+}
+
+// bytes until the next sample, exponentially distributed so every byte is
+// equally likely to be sampled regardless of allocation patterns
+int64_t prof_next_sample(void) {
+    if (!prof_random) prof_random = now_ns() | 1;
+    prof_random ^= prof_random << 13;
+    prof_random ^= prof_random >> 7;
+    prof_random ^= prof_random << 17;
+    double u = (double)(prof_random >> 11) / (double)(1ULL << 53);
+    return (int64_t)(-log(1.0 - u) * (double)prof_sample) + 1;
+}
+
+size_t prof_filter_slot(void* ptr) {
+    return ((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL >> 48;
+}
+
+size_t prof_live_home(void* ptr) {
+    return ((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL % PROF_LIVE;
+}
+
+// finds the slot of a live sampled block, or where to put it if insert is
+// set; the table is never more than three quarters full
+prof_live_t* prof_live_find(void* ptr, int insert) {
+    size_t i = prof_live_home(ptr);
+    while (prof_live[i].ptr) {
+        if (prof_live[i].ptr == ptr) return &prof_live[i];
+        i = (i + 1) % PROF_LIVE;
+    }
+    return insert ? &prof_live[i] : NULL;
+}
+
+// empties a slot, moving later entries of the same probe run back into it
+void prof_live_remove(prof_live_t* live) {
+    size_t hole = live - prof_live, i = hole;
+    while (1) {
+        i = (i + 1) % PROF_LIVE;
+        if (!prof_live[i].ptr) break;
+        size_t home = prof_live_home(prof_live[i].ptr);
+        // entries whose home lies cyclically in (hole, i] stay put
+        if (hole < i ? (home > hole && home <= i) : (home > hole || home <= i)) continue;
+        prof_live[hole] = prof_live[i];
+        hole = i;
+    }
+    prof_live[hole].ptr = NULL;
+    prof_live_count--;
+}
+
+// finds or adds the call site of a backtrace, -1 if the table is full
+int prof_site_of(void** frames, int depth) {
+    uint64_t hash = 1469598103934665603ULL;
+    int i;
+    for (i = 0; i < depth; i++) hash = (hash ^ (uintptr_t)frames[i]) * 1099511628211ULL;
+    if (!hash) hash = 1;
+
+    size_t slot = hash % PROF_SITES, n;
+    for (n = 0; n < PROF_SITES; n++, slot = (slot + 1) % PROF_SITES) {
+        prof_site_t* site = &prof_sites[slot];
+        if (site->hash == hash) return (int)slot;
+        if (!site->hash) {
+            site->hash = hash;
+            memcpy(site->frames, frames, depth * sizeof(void*));
+            site->depth = depth;
+            prof_site_count++;
+            return (int)slot;
+        }
+    }
+    return -1;
+}
+
+// records a sampled allocation of size bytes at ptr
+void prof_record(void* ptr, size_t size) {
+    void* frames[PROF_DEPTH + 8];
+    int depth = backtrace(frames, PROF_DEPTH + 8), skip = 0;
+    while (skip < depth && (uintptr_t)frames[skip] >= prof_text_start && (uintptr_t)frames[skip] < prof_text_end)
+        skip++;
+    depth -= skip;
+    if (depth > PROF_DEPTH) depth = PROF_DEPTH;
+
+    // an allocation is sampled with probability 1 - exp(-size / prof_sample)
+    double p = 1.0 - exp(-(double)size / (double)prof_sample);
+    double weight = p > 0 ? 1.0 / p : 1.0;
+    uint64_t now = now_ns();
+
+    pthread_mutex_lock(&prof_lock);
+    int site = prof_site_of(frames + skip, depth);
+    if (site >= 0) {
+        prof_sites[site].allocs += weight;
+        prof_sites[site].bytes += weight * size;
+
+        // keep a quarter of the table free so lookups stay short
+        prof_live_t* live = prof_live_count < PROF_LIVE / 4 * 3 ? prof_live_find(ptr, 1) : NULL;
+        if (live) {
+            // a block freed while profiling was busy may still be listed
+            if (live->ptr) __atomic_sub_fetch(&prof_filter[prof_filter_slot(ptr)], 1, __ATOMIC_RELAXED);
+            else prof_live_count++;
+            live->ptr = ptr;
+            live->allocated = now;
+            live->weight = weight;
+            live->site = site;
+            __atomic_add_fetch(&prof_filter[prof_filter_slot(ptr)], 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+void prof_malloc(void* ptr, size_t size) {
+    if (prof_busy) return;
+    prof_countdown -= (int64_t)size;
+    if (prof_countdown > 0) return;
+    // backtrace may allocate, which must not be sampled in turn
+    prof_busy = 1;
+    prof_countdown = prof_next_sample();
+    prof_record(ptr, size);
+    prof_busy = 0;
+}
+
+// counts the free of a sampled block toward its call site's churn
+void prof_free(void* ptr) {
+    uint8_t* filter = &prof_filter[prof_filter_slot(ptr)];
+    if (prof_busy || !__atomic_load_n(filter, __ATOMIC_RELAXED)) return;
+
+    pthread_mutex_lock(&prof_lock);
+    prof_live_t* live = prof_live_find(ptr, 0);
+    if (live) {
+        prof_site_t* site = &prof_sites[live->site];
+        site->frees += live->weight;
+        site->lifetime_ns += live->weight * (double)(now_ns() - live->allocated);
+        prof_live_remove(live);
+        __atomic_sub_fetch(filter, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+// finds the executable segment holding this file's code
+int prof_find_text(struct dl_phdr_info* info, size_t size, void* data) {
+    (void)size;
+    (void)data;
+    uintptr_t self = (uintptr_t)&prof_find_text;
+    int i;
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        if (phdr->p_type == PT_LOAD && self >= start && self < start + phdr->p_memsz) {
+            prof_text_start = start;
+            prof_text_end = start + phdr->p_memsz;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// sites whose allocations are freed more often come first, then the ones
+// allocating more often
+int prof_ranks_before(prof_site_t* a, prof_site_t* b) {
+    return a->frees > b->frees || (a->frees == b->frees && a->allocs > b->allocs);
+}
+
+void prof_atfork_child(void) {
+    pthread_mutex_init(&prof_lock, NULL);
+}
+
+void prof_exit(void) {
+    malloc_profile_report(STDERR_FILENO);
+}
+
+void prof_init(void) {
+    prof_busy = 1;
+    prof_start = now_ns();
+    dl_iterate_phdr(prof_find_text, NULL);
+    // the first backtrace loads the unwinder, which allocates
+    void* frame;
+    backtrace(&frame, 1);
+    prof_countdown = prof_next_sample();
+    pthread_atfork(NULL, NULL, prof_atfork_child);
+    atexit(prof_exit);
+    prof_busy = 0;
+}
+
+// logs the current operation if it took longer than watch_ns
+void watch_log(uint64_t ticks) {
+    uint64_t index = __atomic_fetch_add(&watch_head, 1, __ATOMIC_RELAXED);
+    watch_record_t* record = &watch_ring[index % WATCH_RING];
+    int i;
+
+    // readers skip records whose sequence number changes under them
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELEASE);
+    record->op = watch_op.op;
+    record->size = watch_op.size;
+    record->total_ns = (uint64_t)(ticks * watch_tick_ns);
+    for (i = 0; i < WATCH_PHASES; i++) record->phase_ns[i] = (uint64_t)(watch_op.phases[i] * watch_tick_ns);
+    record->depth = 0;
+    if (watch_backtrace) {
+        void* frames[WATCH_DEPTH + 4];
+        watch_op.busy = 1;
+        int depth = backtrace(frames, WATCH_DEPTH + 4), skip = 0;
+        watch_op.busy = 0;
+        while (skip < depth && (uintptr_t)frames[skip] >= prof_text_start && (uintptr_t)frames[skip] < prof_text_end)
+            skip++;
+        record->depth = depth - skip > WATCH_DEPTH ? WATCH_DEPTH : depth - skip;
+        memcpy(record->frames, frames + skip, record->depth * sizeof(void*));
+    }
+    __atomic_store_n(&record->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+// the depth is also kept for the trace, which records only outermost calls
+int watch_enter(int op, size_t size) {
+    if ((!watch_ns && !trace_fd) || watch_op.busy) return 0;
+    if (watch_op.depth++) return 1;
+    watch_op.op = op;
+    watch_op.size = size;
+    memset(watch_op.phases, 0, sizeof(watch_op.phases));
+    watch_op.claimed = 0;
+    watch_op.start = watch_ticks();
+    return 1;
+}
+
+// sets the size of the call being timed, for calls that only learn it from
+// the block
+void watch_size(int active, size_t size) {
+    if (active && watch_op.depth == 1) watch_op.size = size;
+}
+
+void watch_leave(int* active) {
+    if (!*active || --watch_op.depth) return;
+    uint64_t ticks = watch_ticks() - watch_op.start;
+    if (watch_ns && ticks >= watch_threshold) watch_log(ticks);
+}
+
+// formats into a buffer without stdio, which is not async-signal-safe
+void watch_put(char* buf, size_t* len, const char* str) {
+    while (*str && *len < 255) buf[(*len)++] = *str++;
+}
+
+void watch_put_num(char* buf, size_t* len, uint64_t num, int base) {
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[num % base];
+        num /= base;
+    } while (num);
+    while (n && *len < 255) buf[(*len)++] = digits[--n];
+}
+
+void watch_signal_handler(int sig) {
+    (void)sig;
+    malloc_watch_dump(STDERR_FILENO);
+}
+
+void watch_init(void) {
+    if (!prof_text_end) dl_iterate_phdr(prof_find_text, NULL);
+    if (watch_backtrace) {
+        // the first backtrace loads the unwinder, which allocates
+        void* frame;
+        watch_op.busy = 1;
+        backtrace(&frame, 1);
+        watch_op.busy = 0;
+    }
+
+    // calibrate ticks against the monotonic clock
+    uint64_t start_ns = now_ns(), start = watch_ticks(), elapsed;
+    while ((elapsed = now_ns() - start_ns) < 2000000) {}
+    watch_tick_ns = (double)elapsed / (double)(watch_ticks() - start);
+    watch_threshold = (uint64_t)(watch_ns / watch_tick_ns);
+
+    if (watch_signal) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = watch_signal_handler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction((int)watch_signal, &action, NULL);
+    }
+}
+
+// writes out the buffered calls, trace_lock must be held
+void trace_write(void) {
+    if (trace_count && write((int)trace_fd, trace_buffer, trace_count * sizeof(alloc_trace_t)) < 0)
+        trace_fd = 0;
+    trace_count = 0;
+}
+
+void trace_flush(void) {
+    pthread_mutex_lock(&trace_lock);
+    trace_write();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// records a completed call made by the application, calls the allocator
+// makes to itself are part of the call that made them
+void trace_op(int op, void* ptr, void* old, size_t size) {
+    if (watch_op.depth != 1) return;
+    pthread_mutex_lock(&trace_lock);
+    alloc_trace_t* record = &trace_buffer[trace_count++];
+    record->op = op;
+    record->ptr = (uintptr_t)ptr;
+    record->old = (uintptr_t)old;
+    record->size = size;
+    if (trace_count == TRACE_BUFFER) trace_write();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// a child's calls would interleave with the parent's in the same trace
+void trace_atfork_child(void) {
+    pthread_mutex_init(&trace_lock, NULL);
+    trace_count = 0;
+    trace_fd = 0;
+}
+
+void trace_init(void) {
+    pthread_atfork(NULL, NULL, trace_atfork_child);
+    atexit(trace_flush);
+}
+
+// initializes the heap if needed, returns 0 if it is unusable
+int alloc_init(void) {
+    if (!main_heap.heap_top) {
+        parse_conf(getenv("ALLOC_CONF"));
+        main_heap.heap_start = sbrk(0);
+        main_heap.heap_top = main_heap.heap_start;
+        heap_break = main_heap.heap_start;
+        // calibrated first, so allocations made setting up the rest are timed
+        // against the real threshold
+        if (watch_ns) watch_init();
+        if (prof_sample) prof_init();
+        if (trace_fd) trace_init();
+    }
+    return main_heap.heap_top != (void*)-1; // sbrk failed
+}
+
+/**
+ * Allocate space for array in memory
+ *
+ * Allocates a block of memory for an array of num elements, each of them size
+ * bytes long, and initializes all its bits to zero. The effective result is
+ * the allocation of an zero-initialized memory block of (num * size) bytes.
+ *
+ * @param num
+ *    Number of elements to be allocated.
+ * @param size
+ *    Size of elements.
+ *
+ * @return
+ *    A pointer to the memory block allocated by the function.
+ *
+ *    The type of this pointer is always void*, which can be cast to the
+ *    desired type of data pointer in order to be dereferenceable.
+ *
+ *    If the function failed to allocate the requested block of memory, a
+ *    NULL pointer is returned.
+ *
+ * @see http://www.cplusplus.com/reference/clibrary/cstdlib/calloc/
+ */
+void *calloc(size_t num, size_t size) {
+    // implement calloc!
+    // set up before the call is timed, so the first call is traced too
+    if (!alloc_init()) return NULL;
+    WATCH_OP(OP_CALLOC, num * size);
+    if (num == 0 || size == 0) return NULL;
+
+    size_t total_size = num * size;
+    if (total_size / num != size) return NULL;
+
+    // runs and mappings know whether their pages are already zero
+    if (total_size > mmap_threshold || run_pages_for(total_size)) {
+        void* ptr = total_size > mmap_threshold ? huge_malloc(total_size, 1) : run_malloc(total_size, 1);
+        if (ptr && prof_sample) prof_malloc(ptr, total_size);
+        if (ptr && trace_fd) trace_op(OP_CALLOC, ptr, NULL, total_size);
+        return ptr;
+    }
+
+    void* ptr = malloc(total_size);
+    if (!ptr) return NULL;
+
+    uint64_t since = watch_start();
+    memset(ptr, 0, total_size);
+    watch_add(PHASE_ZERO, since);
+    if (trace_fd) trace_op(OP_CALLOC, ptr, NULL, total_size);
+    return ptr;
+}
+
+/**
+ * Allocate memory block
+ *
+ * Allocates a block of size bytes of memory, returning a pointer to the
+ * beginning of the block.  The content of the newly allocated block of
+ * memory is not initialized, remaining with indeterminate values.
+ *
+ * @param size
+ *    Size of the memory block, in bytes.
+ *
+ * @return
+ *    On success, a pointer to the memory block allocated by the function.
+ *
+ *    The type of this pointer is always void*, which can be cast to the
+ *    desired type of data pointer in order to be dereferenceable.
+ *
+ *    If the function failed to allocate the requested block of memory,
+ *    a null pointer is returned.
+ *
+ * @see http://www.cplusplus.com/reference/clibrary/cstdlib/malloc/
+ */
+void *malloc(size_t size) {
+    // implement malloc!
+    // set up before the call is timed, so the first call is traced too
+    if (!alloc_init()) return NULL;
+    WATCH_OP(OP_MALLOC, size);
+    if (!size) return NULL;
+
+    // threads never share a slab, so their objects never share a cache line
+    void* ptr = size <= slab_max ? slab_malloc(size) : NULL;
+    if (!ptr) {
+        if (size > mmap_threshold) ptr = huge_malloc(size, 0);
+        else if (run_pages_for(size)) ptr = run_malloc(size, 0);
+        else ptr = heap_malloc(&main_heap, size);
+    }
+
+    if (ptr && prof_sample) prof_malloc(ptr, size);
+    if (ptr && trace_fd) trace_op(OP_MALLOC, ptr, NULL, size);
+    return ptr;
+}
+
+/**
+ * Deallocate space in memory
+ *
+ * A block of memory previously allocated using a call to malloc(),
+ * calloc() or realloc() is deallocated, making it available again for
+ * further allocations.
+ *
+ * Notice that this function leaves the value of ptr unchanged, hence
+ * it still points to the same (now invalid) location, and not to the
+ * null pointer.
+ *
+ * @param ptr
+ *    Pointer to a memory block previously allocated with malloc(),
+ *    calloc() or realloc() to be deallocated.  If a null pointer is
+ *    passed as argument, no action occurs.
+ */
+void free(void *ptr) {
+    // implement free!
+    WATCH_OP(OP_FREE, 0);
+    if (!ptr) return;
+    // recorded first, so another thread reusing the block is recorded after
+    if (trace_fd) trace_op(OP_FREE, ptr, NULL, 0);
+    if (prof_sample) prof_free(ptr);
+    slab_t* slab = slab_of(ptr);
+    metadata_t* block = ((metadata_t*)ptr) - 1;
+    watch_size(watch_active, slab ? slab->size : block->size);
+    if (slab) {
+        slab_free(slab, ptr);
+        return;
+    }
+    if (block->kind == KIND_RUN) {
+        run_free(block);
+        return;
+    }
+    if (block->kind == KIND_HUGE) {
+        huge_free(block);
+        return;
+    }
+    if (block->kind == KIND_MEMFD || block->kind == KIND_COW) {
+        clone_free(block);
+        return;
+    }
+    if (block->kind == KIND_RECLAIM) {
+        reclaim_free(block);
+        return;
+    }
+
+    heap_free(heap_of(block), block);
+}
+
+// realloc() itself, the public entry point records its result in the trace
+static void* resize(void* ptr, size_t size) {
+    if (!ptr) return malloc(size);
+    if (!size) {
+        free(ptr);
+        return NULL;
+    }
+
+    // slab objects have no header and move once they outgrow their class
+    slab_t* slab = slab_of(ptr);
+    if (slab) {
+        if (size <= slab->size) return ptr;
+        void* new_ptr = malloc(size);
+        if (!new_ptr) return NULL;
+        uint64_t since = watch_start();
+        memcpy(new_ptr, ptr, slab->size);
+        watch_add(PHASE_COPY, since);
+        free(ptr);
+        return new_ptr;
+    }
+
+    metadata_t* block = ((metadata_t*)ptr) - 1;
+    heap_t* heap = heap_of(block);
+    size_t old_size = block->size;
+    size_t new_size = aligned_size(size);
+
+    // huge blocks give back their tail when shrinking to less than half,
+    // copy-on-write views are copied to grow since their file is shared
+    if ((block->kind == KIND_HUGE || block->kind == KIND_MEMFD) && size > mmap_threshold && (new_size > old_size || new_size < old_size / 2))
+        return huge_realloc(block, size);
+    if (new_size <= old_size) return ptr;   // could do block split for optimize
+    
+    if (block->kind == KIND_HEAP && extend_in_place(heap, block, new_size)) return ptr;
+    
+    // stay in the same heap so persistent blocks remain persistent
+    void *new_ptr = heap == &main_heap ? malloc(size) : heap_malloc(heap, size);
+    if (!new_ptr) return NULL;
+    
+    uint64_t since = watch_start();
+    memcpy(new_ptr, ptr, old_size);
+    watch_add(PHASE_COPY, since);
+    free(ptr);
+    
+    return new_ptr;
+}
+
+/**
+ * Reallocate memory block
+ *
+ * The size of the memory block pointed to by the ptr parameter is changed
+ * to the size bytes, expanding or reducing the amount of memory available
+ * in the block.
+ *
+ * The function may move the memory block to a new location, in which case
+ * the new location is returned. The content of the memory block is preserved
+ * up to the lesser of the new and old sizes, even if the block is moved. If
+ * the new size is larger, the value of the newly allocated portion is
+ * indeterminate.
+ *
+ * In case that ptr is NULL, the function behaves exactly as malloc, assigning
+ * a new block of size bytes and returning a pointer to the beginning of it.
+ *
+ * In case that the size is 0, the memory previously allocated in ptr is
+ * deallocated as if a call to free was made, and a NULL pointer is returned.
+ *
+ * @param ptr
+ *    Pointer to a memory block previously allocated with malloc(), calloc()
+ *    or realloc() to be reallocated.
+ *
+ *    If this is NULL, a new block is allocated and a pointer to it is
+ *    returned by the function.
+ *
+ * @param size
+ *    New size for the memory block, in bytes.
+ *
+ *    If it is 0 and ptr points to an existing block of memory, the memory
+ *    block pointed by ptr is deallocated and a NULL pointer is returned.
+ *
+ * @return
+ *    A pointer to the reallocated memory block, which may be either the
+ *    same as the ptr argument or a new location.
+ *
+ *    The type of this pointer is void*, which can be cast to the desired
+ *    type of data pointer in order to be dereferenceable.
+ *
+ *    If the function failed to allocate the requested block of memory,
+ *    a NULL pointer is returned, and the memory block pointed to by
+ *    argument ptr is left unchanged.
+ *
+ * @see http://www.cplusplus.com/reference/clibrary/cstdlib/realloc/
+ */
+void *realloc(void *ptr, size_t size) {
+    // implement realloc!
+    // set up before the call is timed, so the first call is traced too
+    if (!alloc_init()) return NULL;
+    WATCH_OP(OP_REALLOC, size);
+    void* new_ptr = resize(ptr, size);
+    // a failed realloc leaves ptr as it was
+    if (trace_fd && (new_ptr || !size)) trace_op(OP_REALLOC, new_ptr, ptr, size);
+    return new_ptr;
+}
+
+// malloc with the user pointer aligned to align, a power of two
+void* aligned_malloc(size_t align, size_t size) {
+    if (!alloc_init()) return NULL;
+
+    // huge blocks are page-aligned already
+    if (size > mmap_threshold && align <= PAGE) return huge_malloc(size, 0);
+    return heap_memalign(&main_heap, align, size);
+}
+
+// shared by malloc_simd and malloc_simd_zeropad
+void* simd_malloc(size_t nbytes, size_t vector_width, int zero_pad) {
+    if (!nbytes || !vector_width || (vector_width & (vector_width - 1))) return NULL;
+    if (vector_width < 8) vector_width = 8;
+
+    // the pad only reaches the next vector boundary, block slack is reused
+    size_t padded = (nbytes + vector_width - 1) & ~(vector_width - 1);
+    if (padded < nbytes) return NULL; // overflow
+
+    char* ptr = aligned_malloc(vector_width, padded);
+    if (!ptr) return NULL;
+
+    if (zero_pad) memset(ptr + nbytes, 0, padded - nbytes);
+    return ptr;
+}
+
+/**
+ * Allocate memory block for vectorized access
+ *
+ * Allocates nbytes bytes aligned to vector_width, such that full-width
+ * vector loads may run past nbytes up to the next multiple of
+ * vector_width without leaving the block. The padding is not initialized.
+ *
+ * The block is released with free(). realloc() does not preserve the
+ * alignment.
+ *
+ * @param nbytes
+ *    Size of the array, in bytes.
+ * @param vector_width
+ *    Vector width in bytes, a power of two.
+ *
+ * @return
+ *    A pointer to the memory block, or NULL if the request could not be
+ *    satisfied or vector_width is not a power of two.
+ */
+void *malloc_simd(size_t nbytes, size_t vector_width) {
+    return simd_malloc(nbytes, vector_width, 0);
+}
+
+/**
+ * Allocate memory block for vectorized access with a zeroed tail
+ *
+ * Same as malloc_simd(), but the padding between nbytes and the next
+ * multiple of vector_width is zeroed, so unmasked vector tails read zeros.
+ *
+ * @param nbytes
+ *    Size of the array, in bytes.
+ * @param vector_width
+ *    Vector width in bytes, a power of two.
+ *
+ * @return
+ *    A pointer to the memory block, or NULL on failure.
+ */
+void *malloc_simd_zeropad(size_t nbytes, size_t vector_width) {
+    return simd_malloc(nbytes, vector_width, 1);
+}
+
+// offset of column k of a struct-of-arrays block, or its size when k is
+// n_arrays; SIZE_MAX on overflow
+size_t soa_offset(size_t count, size_t k, const size_t elem_sizes[], size_t align) {
+    size_t offset = 0, i;
+    for (i = 0; i < k; i++) {
+        if (elem_sizes[i] && count > (SIZE_MAX - offset) / elem_sizes[i]) return SIZE_MAX;
+        offset += count * elem_sizes[i];
+        if (offset > SIZE_MAX - align) return SIZE_MAX;
+        offset = (offset + align - 1) & ~(align - 1);
+    }
+    return offset;
+}
+
+void soa_pointers(char* base, size_t count, size_t n_arrays, const size_t elem_sizes[], size_t align,
+                  void* out_ptrs[]) {
+    size_t k;
+    for (k = 0; k < n_arrays; k++) out_ptrs[k] = base + soa_offset(count, k, elem_sizes, align);
+}
+
+/**
+ * Allocate a struct-of-arrays block
  *
- * In case that the size is 0, the memory previously allocated in ptr is
- * deallocated as if a call to free was made, and a NULL pointer is returned.
+ * Allocates n_arrays arrays of count elements each in a single block, where
+ * array k has elements of elem_sizes[k] bytes and starts on an align
+ * boundary. The whole block is released with a single free() of the
+ * returned pointer, which is also out_ptrs[0].
+ *
+ * @param count
+ *    Number of elements in each array.
+ * @param n_arrays
+ *    Number of arrays.
+ * @param elem_sizes
+ *    Element size of each array, in bytes.
+ * @param align
+ *    Alignment of each array, a power of two, e.g. a cache line or vector
+ *    width. 0 selects 64.
+ * @param out_ptrs
+ *    Receives the start of each array.
+ *
+ * @return
+ *    A pointer to the block, or NULL if the request could not be satisfied.
+ */
+void *malloc_soa(size_t count, size_t n_arrays, const size_t elem_sizes[], size_t align, void *out_ptrs[]) {
+    if (!align) align = 64;
+    if (!n_arrays || (align & (align - 1))) return NULL;
+    if (align < 8) align = 8;
+
+    size_t total = soa_offset(count, n_arrays, elem_sizes, align);
+    if (!total || total == SIZE_MAX) return NULL;
+
+    char* base = aligned_malloc(align, total);
+    if (!base) return NULL;
+
+    soa_pointers(base, count, n_arrays, elem_sizes, align, out_ptrs);
+    return base;
+}
+
+/**
+ * Resize a struct-of-arrays block
+ *
+ * Changes the element count of every array of a block from malloc_soa()
+ * together. The first min(old_count, new_count) elements of each array are
+ * preserved. The block grows in place when the following memory is free, in
+ * which case the arrays are shifted within it; otherwise it is moved.
+ *
+ * @param base
+ *    Block returned by malloc_soa() or realloc_soa(), or NULL.
+ * @param old_count
+ *    Current number of elements in each array.
+ * @param new_count
+ *    New number of elements in each array.
+ * @param n_arrays, elem_sizes, align
+ *    Same as passed to malloc_soa().
+ * @param out_ptrs
+ *    Receives the new start of each array.
+ *
+ * @return
+ *    A pointer to the resized block, or NULL on failure in which case the
+ *    original block and out_ptrs are left unchanged.
+ */
+void *realloc_soa(void *base, size_t old_count, size_t new_count, size_t n_arrays, const size_t elem_sizes[],
+                  size_t align, void *out_ptrs[]) {
+    if (!base) return malloc_soa(new_count, n_arrays, elem_sizes, align, out_ptrs);
+    if (!align) align = 64;
+    if (!n_arrays || (align & (align - 1))) return NULL;
+    if (align < 8) align = 8;
+
+    size_t total = soa_offset(new_count, n_arrays, elem_sizes, align);
+    if (!total || total == SIZE_MAX) return NULL;
+
+    metadata_t* block = (metadata_t*)base - 1;
+    size_t keep = old_count < new_count ? old_count : new_count;
+    size_t k;
+
+    // huge blocks stay page-aligned when mremap moves them
+    if ((block->kind == KIND_HUGE || block->kind == KIND_MEMFD) && block->size < total && align <= PAGE) {
+        base = realloc(base, total);
+        if (!base) return NULL;
+        block = (metadata_t*)base - 1;
+    }
+
+    if (block->size >= total || (block->kind == KIND_HEAP && extend_in_place(heap_of(block), block, total))) {
+        // shift the arrays within the block, back to front when growing so
+        // no array overwrites one that has not moved yet
+        for (k = 0; k < n_arrays; k++) {
+            size_t col = new_count > old_count ? n_arrays - 1 - k : k;
+            memmove((char*)base + soa_offset(new_count, col, elem_sizes, align),
+                    (char*)base + soa_offset(old_count, col, elem_sizes, align), keep * elem_sizes[col]);
+        }
+        soa_pointers(base, new_count, n_arrays, elem_sizes, align, out_ptrs);
+        return base;
+    }
+
+    char* new_base = aligned_malloc(align, total);
+    if (!new_base) return NULL;
+    for (k = 0; k < n_arrays; k++) {
+        memcpy(new_base + soa_offset(new_count, k, elem_sizes, align),
+               (char*)base + soa_offset(old_count, k, elem_sizes, align), keep * elem_sizes[k]);
+    }
+    free(base);
+
+    soa_pointers(new_base, new_count, n_arrays, elem_sizes, align, out_ptrs);
+    return new_base;
+}
+
+/**
+ * Clone a memory block
+ *
+ * Returns a new block with the same size and contents as ptr. Huge,
+ * page-aligned blocks are cloned copy-on-write: the source and the clone
+ * become private mappings of a memfd holding the block, so they share
+ * physical pages until one side writes to them. Cloning a block that
+ * already shares its file copies only the pages it has written since; the
+ * first clone of an anonymous huge block copies it into a file once, which
+ * the clone_min tunable avoids by backing huge blocks with a memfd from the
+ * start. Smaller blocks are copied.
  *
  * @param ptr
- *    Pointer to a memory block previously allocated with malloc(), calloc()
- *    or realloc() to be reallocated.
+ *    Pointer to a block returned by malloc(), calloc() or realloc().
  *
- *    If this is NULL, a new block is allocated and a pointer to it is
- *    returned by the function.
+ * @return
+ *    A pointer to the clone, to be released with free(), or NULL on failure.
+ */
+void *malloc_clone(void *ptr) {
+    if (!ptr) return NULL;
+    metadata_t* block = (metadata_t*)ptr - 1;
+    slab_t* slab = slab_of(ptr);
+    size_t size = slab ? slab->size : block->size;
+
+    if (!slab && (block->kind == KIND_HUGE || block->kind == KIND_MEMFD || block->kind == KIND_COW)) {
+        void* clone = huge_clone(block);
+        if (clone) return clone;
+    }
+
+    void* copy = malloc(size);
+    if (!copy) return NULL;
+    memcpy(copy, ptr, size);
+    return copy;
+}
+
+/**
+ * Allocate memory as a list of discontiguous pieces
+ *
+ * Covers total bytes with pieces carved out of the heap's existing free
+ * blocks before growing it: a single free block that fits the whole
+ * request is used if there is one, otherwise free blocks of at least
+ * min_chunk bytes are taken in free list order, and whatever they do not
+ * cover comes from one malloc() as the last piece.
+ *
+ * @param total
+ *    Number of bytes to allocate.
+ * @param min_chunk
+ *    Smallest piece worth taking, except for the last one.
+ * @param out
+ *    Receives the pieces; their lengths add up to total.
+ * @param max_iov
+ *    Capacity of out.
+ *
+ * @return
+ *    The number of pieces written to out, or -1 on failure, in which case
+ *    nothing stays allocated.
+ */
+int malloc_iov(size_t total, size_t min_chunk, struct iovec *out, int max_iov) {
+    // sizes this large would wrap when aligned
+    if (!total || total > SIZE_MAX - 7 || max_iov < 1 || !alloc_init()) return -1;
+    if (min_chunk > total) min_chunk = total;
+
+    size_t remaining = total;
+    size_t min_size = aligned_size(min_chunk ? min_chunk : 1);
+    int n = 0;
+
+    while (remaining && n < max_iov) {
+        size_t want = aligned_size(remaining);
+        // the last slot has to cover everything that is left
+        metadata_t* block = find_free_block(&main_heap, want);
+        if (!block && n < max_iov - 1 && min_size < want) block = find_free_block(&main_heap, min_size);
+        if (!block) break;
+
+        size_t take = block->size < want ? block->size : want;
+        split_block(&main_heap, block, take);
+        out[n].iov_base = block + 1;
+        out[n].iov_len = take < remaining ? take : remaining;
+        remaining -= out[n].iov_len;
+        n++;
+    }
+
+    if (remaining) {
+        void* ptr = malloc(remaining);
+        if (!ptr) {
+            free_iov(out, n);
+            return -1;
+        }
+        out[n].iov_base = ptr;
+        out[n].iov_len = remaining;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Release the pieces of malloc_iov()
+ *
+ * @param iov
+ *    Pieces returned by malloc_iov().
+ * @param iovcnt
+ *    Number of pieces.
+ */
+void free_iov(struct iovec *iov, int iovcnt) {
+    int i;
+    for (i = 0; i < iovcnt; i++) free(iov[i].iov_base);
+}
+
+/**
+ * Allocate a reclaimable memory block
+ *
+ * Returns a pinned, page-aligned block for data the application can
+ * regenerate, such as cache entries. Once unpinned with malloc_unpin(),
+ * the kernel may drop its pages under memory pressure (MADV_FREE), and the
+ * allocator discards it when it cannot otherwise get memory or when
+ * malloc_reclaim() is called. malloc_pin() tells whether the contents
+ * survived. The block is released with free().
  *
  * @param size
- *    New size for the memory block, in bytes.
+ *    Size of the memory block, in bytes.
  *
- *    If it is 0 and ptr points to an existing block of memory, the memory
- *    block pointed by ptr is deallocated and a NULL pointer is returned.
+ * @return
+ *    A pointer to the pinned block, or NULL on failure.
+ */
+void *malloc_reclaimable(size_t size) {
+    if (!size || !alloc_init()) return NULL;
+    size_t pages = (size + PAGE - 1) / PAGE;
+    if (pages > SIZE_MAX / PAGE / 2) return NULL;
+
+    // room for one saved word per page, then the state and header
+    size_t header = pages * sizeof(uint64_t) + sizeof(reclaim_t) + sizeof(metadata_t);
+    header = (header + PAGE - 1) & ~((size_t)PAGE - 1);
+    char* base = map_anon(header + pages * PAGE);
+    if (base == MAP_FAILED) return NULL;
+
+    metadata_t* block = (metadata_t*)(base + header) - 1;
+    block->size = pages * PAGE;
+    block->free = 0;
+    block->kind = KIND_RECLAIM;
+    block->next = NULL;
+    block->prev = NULL;
+    reclaim_of(block)->header = header;
+    reclaim_of(block)->pins = 1;
+    reclaim_of(block)->discarded = 0;
+    return (void*)(block + 1);
+}
+
+/**
+ * Pin a reclaimable block
+ *
+ * Keeps the block from being discarded until a matching malloc_unpin().
+ * Pins nest.
+ *
+ * @param ptr
+ *    Block returned by malloc_reclaimable().
  *
  * @return
- *    A pointer to the reallocated memory block, which may be either the
- *    same as the ptr argument or a new location.
+ *    1 if the contents survived since the block was unpinned, 0 if some of
+ *    them were discarded and have to be regenerated, -1 if the block could
+ *    not be made accessible again and stays unpinned.
+ */
+int malloc_pin(void *ptr) {
+    metadata_t* block = (metadata_t*)ptr - 1;
+    reclaim_t* reclaim = reclaim_of(block);
+    if (reclaim->pins++) return 1;
+
+    if (reclaim->discarded) {
+        if (mprotect(ptr, block->size, PROT_READ | PROT_WRITE)) {
+            reclaim->pins--;
+            return -1;
+        }
+        reclaim->discarded = 0;
+        return 0;
+    }
+    reclaim_remove(block);
+
+    // each page starts with the canary while unpinned; putting the saved
+    // word back dirties the page so the kernel keeps it, and fails if the
+    // kernel already replaced it with a zero page
+    uint64_t* saved = (uint64_t*)((char*)ptr - reclaim->header);
+    size_t pages = block->size / PAGE, i;
+    int intact = 1;
+    for (i = 0; i < pages; i++) {
+        uint64_t expected = RECLAIM_CANARY;
+        uint64_t* word = (uint64_t*)((char*)ptr + i * PAGE);
+        if (!__atomic_compare_exchange_n(word, &expected, saved[i], 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            intact = 0;
+    }
+    return intact;
+}
+
+/**
+ * Unpin a reclaimable block
  *
- *    The type of this pointer is void*, which can be cast to the desired
- *    type of data pointer in order to be dereferenceable.
+ * Once its last pin is dropped the block may be discarded at any time, and
+ * must not be accessed until it is pinned again.
  *
- *    If the function failed to allocate the requested block of memory,
- *    a NULL pointer is returned, and the memory block pointed to by
- *    argument ptr is left unchanged.
+ * @param ptr
+ *    Block returned by malloc_reclaimable().
+ */
+void malloc_unpin(void *ptr) {
+    metadata_t* block = (metadata_t*)ptr - 1;
+    reclaim_t* reclaim = reclaim_of(block);
+    if (--reclaim->pins) return;
+
+    uint64_t* saved = (uint64_t*)((char*)ptr - reclaim->header);
+    size_t pages = block->size / PAGE, i;
+    for (i = 0; i < pages; i++) {
+        uint64_t* word = (uint64_t*)((char*)ptr + i * PAGE);
+        saved[i] = *word;
+        *word = RECLAIM_CANARY;
+    }
+#ifdef MADV_FREE
+    madvise(ptr, block->size, MADV_FREE);
+#endif
+
+    block->next = NULL;
+    block->prev = reclaim_tail;
+    if (reclaim_tail) reclaim_tail->next = block;
+    else reclaim_head = block;
+    reclaim_tail = block;
+}
+
+/**
+ * Discard unpinned reclaimable blocks
  *
- * @see http://www.cplusplus.com/reference/clibrary/cstdlib/realloc/
+ * Releases the least recently unpinned blocks first, for applications
+ * that learn about memory pressure before allocations start failing.
+ *
+ * @param bytes
+ *    Amount of memory to release.
+ *
+ * @return
+ *    The number of bytes released, which is less than bytes if not enough
+ *    blocks were unpinned.
  */
-void *realloc(void *ptr, size_t size) {
-    // implement realloc!
-    if (!ptr) return malloc(size);
-    if (!size) {
-        free(ptr);
-        return NULL;
+size_t malloc_reclaim(size_t bytes) {
+    return reclaim_unpinned(bytes);
+}
+
+/**
+ * Bytes waiting to be unmapped
+ *
+ * Large mappings freed by the allocator are unmapped by a background
+ * thread; until it gets to them they still count against the process's
+ * memory and address space limits.
+ *
+ * @return
+ *    The number of bytes queued for unmapping or being unmapped.
+ */
+size_t malloc_release_pending(void) {
+    pthread_mutex_lock(&release_lock);
+    size_t pending = release_pending;
+    pthread_mutex_unlock(&release_lock);
+    return pending;
+}
+
+/**
+ * Write the churn profile
+ *
+ * Ranks the call sites of sampled allocations by how many of their
+ * allocations are freed again per second, the ones most worth moving to an
+ * arena or pool. Counts are estimates scaled up from the samples taken
+ * every prof_sample bytes on average. Written at exit when profiling is
+ * enabled.
+ *
+ * @param fd
+ *    File descriptor to write the report to.
+ */
+void malloc_profile_report(int fd) {
+    if (!prof_sample) return;
+    prof_busy = 1;
+    pthread_mutex_lock(&prof_lock);
+
+    double seconds = (double)(now_ns() - prof_start) / 1e9;
+    if (seconds <= 0) seconds = 1e-9;
+    char line[256];
+    int len = snprintf(line, sizeof(line), "alloc: churn profile over %.2fs, %zu call sites, sampling every %zu bytes\n"
+                       "rank     allocs/s      bytes/s      pairs/s  lifetime\n", seconds, prof_site_count, prof_sample);
+    if (write(fd, line, len) < 0) goto out;
+
+    // insertion of each site into the top PROF_REPORT
+    int ranked[PROF_REPORT];
+    int n = 0, i, j;
+    for (i = 0; i < PROF_SITES; i++) {
+        if (!prof_sites[i].hash) continue;
+        for (j = n; j > 0 && prof_ranks_before(&prof_sites[i], &prof_sites[ranked[j - 1]]); j--) {
+            if (j < PROF_REPORT) ranked[j] = ranked[j - 1];
+        }
+        if (j < PROF_REPORT) {
+            ranked[j] = i;
+            if (n < PROF_REPORT) n++;
+        }
     }
 
-    metadata_t* block = ((metadata_t*)ptr) - 1;
-    size_t old_size = block->size;
-    size_t new_size = aligned_size(size);
+    for (i = 0; i < n; i++) {
+        prof_site_t* site = &prof_sites[ranked[i]];
+        double lifetime = site->frees > 0 ? site->lifetime_ns / site->frees / 1000.0 : 0;
+        len = snprintf(line, sizeof(line), "%4d %12.0f %12.0f %12.0f  %.1fus%s\n", i + 1, site->allocs / seconds,
+                       site->bytes / seconds, site->frees / seconds, lifetime, site->frees > 0 ? "" : " (never freed)");
+        if (write(fd, line, len) < 0) goto out;
+        backtrace_symbols_fd(site->frames, site->depth, fd);
+    }
 
-    if (new_size <= old_size) return ptr;   // could do block split for optimize
-    
-    metadata_t* next = (metadata_t*)((char*)block + sizeof(metadata_t) + old_size + sizeof(footer_t));
-    if ((void*)next < heap_top && next->free) {
-        size_t combined = old_size + sizeof(metadata_t) + next->size + sizeof(footer_t);
-        
-        if (combined >= new_size) {
-            remove_from_free_list(next);
-            block->size = combined;
-            set_footer(block);
-            return ptr;
+out:
+    pthread_mutex_unlock(&prof_lock);
+    prof_busy = 0;
+}
+
+/**
+ * Write the slow operation log
+ *
+ * Lists the most recent malloc(), calloc(), realloc() and free() calls that
+ * took at least watch_ns nanoseconds, oldest first, with where their time
+ * went and, with watch_backtrace set, the return addresses of their
+ * callers. Async-signal-safe; called from the watch_signal handler.
+ *
+ * @param fd
+ *    File descriptor to write the log to.
+ */
+void malloc_watch_dump(int fd) {
+    static const char* ops[] = {"malloc", "calloc", "realloc", "free"};
+    static const char* phases[] = {"search", "split", "coalesce", "syscall", "copy", "zero"};
+    uint64_t head = __atomic_load_n(&watch_head, __ATOMIC_ACQUIRE);
+    uint64_t index = head > WATCH_RING ? head - WATCH_RING : 0;
+    char buf[256];
+    size_t len;
+    int i;
+
+    for (; index < head; index++) {
+        watch_record_t* slot = &watch_ring[index % WATCH_RING];
+        watch_record_t record;
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != index + 1) continue;
+        memcpy(&record, slot, sizeof(record));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != index + 1) continue;
+
+        len = 0;
+        watch_put(buf, &len, "alloc: slow ");
+        watch_put(buf, &len, ops[record.op]);
+        watch_put(buf, &len, " of ");
+        watch_put_num(buf, &len, record.size, 10);
+        watch_put(buf, &len, " bytes");
+        watch_put(buf, &len, " took ");
+        watch_put_num(buf, &len, record.total_ns, 10);
+        watch_put(buf, &len, "ns (");
+        for (i = 0; i < WATCH_PHASES; i++) {
+            watch_put(buf, &len, i ? ", " : "");
+            watch_put(buf, &len, phases[i]);
+            watch_put(buf, &len, " ");
+            watch_put_num(buf, &len, record.phase_ns[i], 10);
         }
+        watch_put(buf, &len, ")\n");
+        if (write(fd, buf, len) < 0) return;
+
+        if (!record.depth) continue;
+        len = 0;
+        watch_put(buf, &len, "  at");
+        for (i = 0; i < record.depth; i++) {
+            watch_put(buf, &len, " 0x");
+            watch_put_num(buf, &len, (uintptr_t)record.frames[i], 16);
+        }
+        watch_put(buf, &len, "\n");
+        if (write(fd, buf, len) < 0) return;
     }
-    
-    void *new_ptr = malloc(size);
-    if (!new_ptr) return NULL;
-    
-    memcpy(new_ptr, ptr, old_size);
-    free(ptr);
-    
-    return new_ptr;
+}
+
+/**
+ * Open a persistent heap
+ *
+ * Maps the file at path as a heap whose boundary tags, free list and root
+ * pointer live inside the file itself, so a later process can remap it and
+ * continue using its data structures without deserializing them. A new file
+ * is created and sized to capacity bytes if it does not exist.
+ *
+ * The file is mapped back at the address it was created at when possible.
+ * If that range is taken, the heap is mapped elsewhere and the allocator's
+ * own pointers (free list and root) are relocated; pointers the program
+ * stored inside its blocks are not, so such data should be reached through
+ * the root or stored as offsets.
+ *
+ * Only one persistent heap can be open at a time.
+ *
+ * @param path
+ *    Backing file.
+ * @param capacity
+ *    Size of the heap in bytes when the file is created, ignored otherwise.
+ * @param base
+ *    Preferred address for a new heap, or NULL to let the kernel choose.
+ * @param was_clean
+ *    If not NULL, set to 1 if the heap was last closed with pheap_close()
+ *    (or is new) and 0 if the last process using it did not close it.
+ *
+ * @return
+ *    0 on success, -1 on failure.
+ */
+int pheap_open(const char* path, size_t capacity, void* base, int* was_clean) {
+    if (pheap) return -1;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // existing files keep their own base and capacity
+    int created = st.st_size == 0;
+    if (!created) {
+        pheap_header_t saved;
+        if (pread(fd, &saved, sizeof(saved), 0) != sizeof(saved) || saved.magic != PHEAP_MAGIC
+            || saved.capacity != (size_t)st.st_size) {
+            close(fd);
+            return -1;
+        }
+        base = saved.base;
+        capacity = saved.capacity;
+    } else {
+        capacity = (capacity + getpagesize() - 1) & ~((size_t)getpagesize() - 1);
+        if (capacity < (size_t)getpagesize() || ftruncate(fd, capacity) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    int flags = MAP_SHARED;
+#ifdef MAP_FIXED_NOREPLACE
+    if (base) flags |= MAP_FIXED_NOREPLACE;
+#endif
+    pheap_header_t* header = mmap(base, capacity, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (header == MAP_FAILED && base)
+        header = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    if (created) {
+        header->magic = PHEAP_MAGIC;
+        header->capacity = capacity;
+        header->clean = 1;
+        header->root = NULL;
+        header->heap.free_list_head = NULL;
+        header->heap.heap_start = (char*)header + aligned_size(sizeof(pheap_header_t));
+        header->heap.heap_top = header->heap.heap_start;
+        header->heap.heap_end = (char*)header + capacity;
+    } else if ((void*)header != header->base) {
+        pheap_relocate(header, (char*)header - (char*)header->base);
+    }
+    header->base = header;
+
+    if (was_clean) *was_clean = header->clean;
+
+    // mark the heap in use so a crash leaves it flagged as unclean
+    header->clean = 0;
+    msync(header, sizeof(pheap_header_t), MS_SYNC);
+
+    pheap = header;
+    pheap_fd = fd;
+    return 0;
+}
+
+/**
+ * Close the persistent heap
+ *
+ * Flushes the heap to its file, marks it as cleanly closed and unmaps it.
+ * Blocks allocated from it must not be used or freed afterwards.
+ *
+ * @return
+ *    0 on success, -1 if no persistent heap is open or flushing failed.
+ */
+int pheap_close(void) {
+    if (!pheap) return -1;
+
+    pheap->clean = 1;
+    int ret = msync(pheap, pheap->capacity, MS_SYNC);
+    munmap(pheap, pheap->capacity);
+    close(pheap_fd);
+
+    pheap = NULL;
+    pheap_fd = -1;
+    return ret ? -1 : 0;
+}
+
+/**
+ * Allocate memory block from the persistent heap
+ *
+ * Behaves like malloc() but places the block inside the open persistent
+ * heap. The block is released with free() and resized with realloc(),
+ * which keeps it inside the persistent heap.
+ *
+ * @param size
+ *    Size of the memory block, in bytes.
+ *
+ * @return
+ *    A pointer to the memory block, or NULL if no persistent heap is open
+ *    or it has no room left.
+ */
+void *pheap_malloc(size_t size) {
+    if (!pheap || !size) return NULL;
+    return heap_malloc(&pheap->heap, size);
+}
+
+/**
+ * Set the root pointer of the persistent heap
+ *
+ * The root is the entry point a restarted process uses to find its data.
+ *
+ * @param root
+ *    Pointer into the persistent heap, or NULL.
+ */
+void pheap_set_root(void *root) {
+    if (pheap) pheap->root = root;
+}
+
+/**
+ * Get the root pointer of the persistent heap
+ *
+ * @return
+ *    The root last stored with pheap_set_root(), or NULL if no persistent
+ *    heap is open.
+ */
+void *pheap_get_root(void) {
+    return pheap ? pheap->root : NULL;
+}
+
+// returns the recycling class of a frame size, or -1 if frames that large are not recycled
+int frame_class(size_t size) {
+    size_t class = (size + FRAME_QUANTUM - 1) / FRAME_QUANTUM;
+    if (!class || class > FRAME_CLASSES) return -1;
+    return (int)class - 1;
+}
+
+// releases the recycled frames of an exiting thread
+void frame_flush(void* arg) {
+    (void)arg;
+    size_t i;
+    for (i = 0; i < FRAME_CLASSES; i++) {
+        while (frame_lists[i]) {
+            void* frame = frame_lists[i];
+            frame_lists[i] = *(void**)frame;
+            free(frame);
+        }
+        frame_counts[i] = 0;
+    }
+}
+
+void frame_key_create(void) {
+    pthread_key_create(&frame_key, frame_flush);
+}
+
+/**
+ * Allocate a coroutine frame
+ *
+ * Frames are taken from the calling thread's recycling list for their size
+ * class, or from the heap when the list is empty. Frames larger than
+ * FRAME_CLASSES * FRAME_QUANTUM bytes are plain malloc() blocks.
+ *
+ * @param size
+ *    Size of the frame, in bytes.
+ *
+ * @return
+ *    A pointer to the frame, or NULL on failure. Release it with
+ *    free_frame() and the same size.
+ */
+void *malloc_frame(size_t size) {
+    int class = frame_class(size);
+    if (class < 0) return malloc(size);
+
+    void* frame = frame_lists[class];
+    if (frame) {
+        frame_lists[class] = *(void**)frame;
+        frame_counts[class]--;
+        return frame;
+    }
+    return malloc((size_t)(class + 1) * FRAME_QUANTUM);
+}
+
+/**
+ * Release a coroutine frame
+ *
+ * Pushes the frame onto the calling thread's recycling list for its size
+ * class, so the next frame of that class reuses it while it is still warm
+ * in cache. Lists hold at most frame_cache frames; beyond that, and when
+ * the thread exits, frames go back to the heap with free().
+ *
+ * @param ptr
+ *    Frame returned by malloc_frame(), possibly on another thread.
+ * @param size
+ *    Size the frame was allocated with.
+ */
+void free_frame(void *ptr, size_t size) {
+    if (!ptr) return;
+
+    int class = frame_class(size);
+    if (class < 0 || frame_counts[class] >= frame_cache) {
+        free(ptr);
+        return;
+    }
+
+    // the key destructor runs only for threads with a non-NULL value
+    if (!frame_registered) {
+        pthread_once(&frame_once, frame_key_create);
+        pthread_setspecific(frame_key, (void*)1);
+        frame_registered = 1;
+    }
+
+    *(void**)ptr = frame_lists[class];
+    frame_lists[class] = ptr;
+    frame_counts[class]++;
 }
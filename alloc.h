@@ -0,0 +1,70 @@
+/**
+ * Extensions to the standard allocation functions provided by alloc.c.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// aligned, padded arrays for vectorized kernels
+void *malloc_simd(size_t nbytes, size_t vector_width);
+void *malloc_simd_zeropad(size_t nbytes, size_t vector_width);
+
+// struct-of-arrays allocation in a single block
+void *malloc_soa(size_t count, size_t n_arrays, const size_t elem_sizes[], size_t align, void *out_ptrs[]);
+void *realloc_soa(void *base, size_t old_count, size_t new_count, size_t n_arrays, const size_t elem_sizes[],
+                  size_t align, void *out_ptrs[]);
+
+// copy-on-write clone of a block
+void *malloc_clone(void *ptr);
+
+// scatter-gather allocation from the heap's free blocks
+int malloc_iov(size_t total, size_t min_chunk, struct iovec *out, int max_iov);
+void free_iov(struct iovec *iov, int iovcnt);
+
+// blocks the allocator may discard while unpinned
+void *malloc_reclaimable(size_t size);
+int malloc_pin(void *ptr);
+void malloc_unpin(void *ptr);
+size_t malloc_reclaim(size_t bytes);
+
+// bytes of freed mappings not yet unmapped in the background
+size_t malloc_release_pending(void);
+
+// churn profiler report, enabled with ALLOC_CONF=prof_sample:<bytes>
+void malloc_profile_report(int fd);
+
+// slow operation log, enabled with ALLOC_CONF=watch_ns:<ns>
+void malloc_watch_dump(int fd);
+
+// call recorded with ALLOC_CONF=trace_fd:<fd>, replayed by tuner.c
+#define ALLOC_TRACE_MALLOC 0
+#define ALLOC_TRACE_CALLOC 1
+#define ALLOC_TRACE_REALLOC 2
+#define ALLOC_TRACE_FREE 3
+
+typedef struct alloc_trace {
+    uint64_t op;
+    uint64_t ptr;   // block returned, or freed
+    uint64_t old;   // block passed to realloc
+    uint64_t size;
+} alloc_trace_t;
+
+// persistent file-backed heap
+int pheap_open(const char* path, size_t capacity, void* base, int* was_clean);
+int pheap_close(void);
+void *pheap_malloc(size_t size);
+void pheap_set_root(void *root);
+void *pheap_get_root(void);
+
+// recycled coroutine frames, see coro-alloc.hpp
+void *malloc_frame(size_t size);
+void free_frame(void *ptr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,28 @@
+/**
+ * Coroutine frame allocation hooks backed by alloc.c.
+ *
+ * Derive a coroutine's promise_type from recycled_frame and the compiler
+ * allocates its frames with malloc_frame() and releases them with
+ * free_frame(), passing the frame size back through sized delete:
+ *
+ *     struct task {
+ *         struct promise_type : recycled_frame { ... };
+ *     };
+ */
+#pragma once
+#include <cstddef>
+#include <new>
+
+#include "alloc.h"
+
+struct recycled_frame {
+    static void *operator new(std::size_t size) {
+        void *frame = malloc_frame(size);
+        if (!frame) throw std::bad_alloc();
+        return frame;
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept {
+        free_frame(ptr, size);
+    }
+};
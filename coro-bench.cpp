@@ -0,0 +1,123 @@
+/**
+ * Coroutine pipeline benchmark.
+ *
+ * Runs the same pipeline of nested coroutines with frames from the global
+ * operator new and, when alloc.so is preloaded, with recycled frames:
+ *
+ *     ./coro-bench
+ *     LD_PRELOAD=./alloc.so ./coro-bench
+ */
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <utility>
+
+#include "coro-alloc.hpp"
+
+// resolved only when alloc.so is preloaded
+#pragma weak malloc_frame
+#pragma weak free_frame
+
+struct plain_frame {};
+
+template <class Frame> struct task {
+    struct promise_type : Frame {
+        int value = 0;
+        std::coroutine_handle<> continuation;
+
+        task get_return_object() { return task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        void return_value(int v) { value = v; }
+        void unhandled_exception() { std::terminate(); }
+
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                auto next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        final_awaiter final_suspend() noexcept { return {}; }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+
+    explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+    task(task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+    ~task() {
+        if (handle) handle.destroy();
+    }
+
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+    int await_resume() noexcept { return handle.promise().value; }
+
+    // runs a top-level task, which never suspends past its children
+    int run() {
+        handle.resume();
+        return handle.promise().value;
+    }
+};
+
+// stages keep buffers live across suspension points so each has its own frame size
+template <class Frame> task<Frame> parse(int x) {
+    std::array<char, 48> token{};
+    token[x % token.size()] = (char)x;
+    co_await std::suspend_never{};
+    co_return token[x % token.size()] + 1;
+}
+
+template <class Frame> task<Frame> transform(int x) {
+    std::array<char, 400> scratch{};
+    scratch[x % scratch.size()] = (char)x;
+    int parsed = co_await parse<Frame>(x);
+    co_return parsed * 2 + scratch[x % scratch.size()];
+}
+
+template <class Frame> task<Frame> request(int x) {
+    std::array<char, 1500> buffer{};
+    buffer[x % buffer.size()] = (char)x;
+    int a = co_await transform<Frame>(x);
+    int b = co_await parse<Frame>(a);
+    int c = co_await transform<Frame>(b);
+    co_return a + b + c + buffer[x % buffer.size()];
+}
+
+// keeps a window of requests in flight, like a server handling concurrent connections
+template <class Frame> double run_pipeline(int requests, int window) {
+    auto start = std::chrono::steady_clock::now();
+    long sum = 0;
+    for (int i = 0; i < requests; i += window) {
+        task<Frame>* inflight = static_cast<task<Frame>*>(std::malloc(window * sizeof(task<Frame>)));
+        for (int j = 0; j < window; j++) new (&inflight[j]) task<Frame>(request<Frame>(i + j));
+        for (int j = 0; j < window; j++) sum += inflight[j].run();
+        for (int j = window - 1; j >= 0; j--) inflight[j].~task();
+        std::free(inflight);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (sum == 42) std::puts("");
+    return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    int requests = argc > 1 ? std::atoi(argv[1]) : 2000000;
+    const int windows[] = {1, 16, 256};
+
+    for (int window : windows) {
+        double plain = run_pipeline<plain_frame>(requests, window);
+        std::printf("window %3d  operator new  %.3fs", window, plain);
+        if (malloc_frame) {
+            double recycled = run_pipeline<recycled_frame>(requests, window);
+            std::printf("  recycled  %.3fs", recycled);
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
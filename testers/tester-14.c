@@ -0,0 +1,79 @@
+/**
+ * malloc
+ * CS 341 - Fall 2025
+ */
+#include "tester-utils.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define NUM_THREADS 4
+#define NUM_INCREMENTS 50000000L
+#define CACHE_LINE 64
+
+static pthread_mutex_t turn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER;
+static int turn = 0;
+static long *counters[NUM_THREADS];
+
+void *worker(void *arg) {
+    long id = (long)arg;
+
+    // take turns so an allocator without thread-owned memory hands out
+    // neighbouring blocks to different threads
+    pthread_mutex_lock(&turn_lock);
+    while (turn != id)
+        pthread_cond_wait(&turn_cond, &turn_lock);
+    counters[id] = malloc(sizeof(long));
+    *counters[id] = 0;
+    turn++;
+    pthread_cond_broadcast(&turn_cond);
+    while (turn != NUM_THREADS)
+        pthread_cond_wait(&turn_cond, &turn_lock);
+    pthread_mutex_unlock(&turn_lock);
+
+    volatile long *counter = counters[id];
+    long i;
+    for (i = 0; i < NUM_INCREMENTS; i++)
+        (*counter)++;
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    malloc(1);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t threads[NUM_THREADS];
+    long i, j;
+    for (i = 0; i < NUM_THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, (void *)i);
+    for (i = 0; i < NUM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        if (*counters[i] != NUM_INCREMENTS) {
+            fprintf(stderr, "Memory failed to contain correct data!\n");
+            return 1;
+        }
+        for (j = i + 1; j < NUM_THREADS; j++) {
+            if ((uintptr_t)counters[i] / CACHE_LINE ==
+                (uintptr_t)counters[j] / CACHE_LINE) {
+                fprintf(stderr,
+                        "Blocks of different threads share a cache line!\n");
+                return 1;
+            }
+        }
+    }
+
+    fprintf(stderr, "Counters updated in %.2f seconds\n",
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    for (i = 0; i < NUM_THREADS; i++)
+        free(counters[i]);
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
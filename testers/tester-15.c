@@ -0,0 +1,149 @@
+/**
+ * malloc
+ * CS 341 - Fall 2025
+ */
+#include "tester-utils.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../alloc.h"
+
+// resolved only when alloc.so is preloaded
+#pragma weak malloc_clone
+
+#define CLONE_SIZE (64 * M)
+#define FORK_SIZE (16 * M)
+#define PAGE 4096
+
+// writes a different byte to the start of every page
+void fill(char *ptr, size_t len, char seed) {
+    size_t i;
+    for (i = 0; i < len; i += PAGE)
+        ptr[i] = (char)(seed + i / PAGE);
+}
+
+int check(char *ptr, size_t len, char seed) {
+    size_t i;
+    for (i = 0; i < len; i += PAGE)
+        if (ptr[i] != (char)(seed + i / PAGE))
+            return 0;
+    return 1;
+}
+
+int fail(const char *what) {
+    fprintf(stderr, "%s\n", what);
+    return 1;
+}
+
+// with clone_min set, huge blocks are shared file mappings until cloned or
+// forked, and a fork must still give the child its own copy
+int fork_test(void) {
+    char *block = malloc(FORK_SIZE);
+    if (!block)
+        return fail("Memory failed to allocate!");
+    fill(block, FORK_SIZE, 1);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return fail("fork failed!");
+    if (!pid) {
+        if (!check(block, FORK_SIZE, 1))
+            _exit(1);
+        block[0] = 42;
+        block[FORK_SIZE - 1] = 42;
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        return fail("Child did not see the parent's data!");
+    if (!check(block, FORK_SIZE, 1) || block[FORK_SIZE - 1] == 42)
+        return fail("Child's writes reached the parent!");
+
+    // the block is a copy-on-write view now, which clones and writes still
+    // keep apart
+    char *clone = malloc_clone(block);
+    if (!clone)
+        return fail("Clone failed!");
+    block[PAGE] = 7;
+    clone[2 * PAGE] = 9;
+    if (clone[PAGE] != 2 || block[2 * PAGE] != 3)
+        return fail("Clone and source did not diverge!");
+
+    free(clone);
+    free(block);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    malloc(1);
+
+    if (!malloc_clone)
+        return fail("malloc_clone is not available!");
+    if (argc > 1 && !strcmp(argv[1], "fork"))
+        return fork_test();
+
+    char *source = malloc(CLONE_SIZE);
+    if (!source)
+        return fail("Memory failed to allocate!");
+    fill(source, CLONE_SIZE, 0);
+
+    char *clone = malloc_clone(source);
+    if (!clone || clone == source)
+        return fail("Clone failed!");
+    if (!check(clone, CLONE_SIZE, 0))
+        return fail("Clone does not match its source!");
+
+    // writes after cloning stay on their side
+    source[10 * PAGE] = 99;
+    clone[11 * PAGE] = 77;
+    if (clone[10 * PAGE] != 10 || source[11 * PAGE] != 11)
+        return fail("Clone and source did not diverge!");
+
+    // cloning a block that is itself a written copy-on-write view
+    char *second = malloc_clone(clone);
+    char *third = malloc_clone(source);
+    if (!second || !third)
+        return fail("Clone failed!");
+    if (second[11 * PAGE] != 77 || second[10 * PAGE] != 10 ||
+        third[10 * PAGE] != 99 || third[11 * PAGE] != 11 ||
+        third[12 * PAGE] != 12)
+        return fail("Re-clone does not match its source!");
+
+    // clones keep their contents when they grow
+    second = realloc(second, 2 * CLONE_SIZE);
+    if (!second || second[11 * PAGE] != 77)
+        return fail("Memory failed to contain correct data after realloc()!");
+    second[2 * CLONE_SIZE - 1] = 1;
+
+    // small blocks are copied
+    char *small = malloc(100);
+    strcpy(small, "clone");
+    char *small_clone = malloc_clone(small);
+    if (!small_clone || small_clone == small || strcmp(small_clone, "clone"))
+        return fail("Small clone failed!");
+
+    free(source);
+    free(clone);
+    free(second);
+    free(third);
+    free(small);
+    free(small_clone);
+
+    // run again with huge blocks backed by a memfd from the start
+    pid_t pid = fork();
+    if (pid < 0)
+        return fail("fork failed!");
+    if (!pid) {
+        setenv("ALLOC_CONF", "clone_min:1m", 1);
+        execl("/proc/self/exe", argv[0], "fork", (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        return 1;
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
@@ -0,0 +1,166 @@
+/**
+ * malloc
+ * CS 341 - Fall 2025
+ */
+#include "tester-utils.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../alloc.h"
+
+// resolved only when alloc.so is preloaded
+#pragma weak pheap_open
+#pragma weak pheap_close
+#pragma weak pheap_malloc
+#pragma weak pheap_set_root
+#pragma weak pheap_get_root
+
+#define HEAP_SIZE (4 * M)
+#define NUM_VALUES 1000
+
+static char path[64];
+static int base_pipe[2];
+
+int check_values(long *values) {
+    int i;
+    for (i = 0; i < NUM_VALUES; i++)
+        if (values[i] != i * 3)
+            return 0;
+    return 1;
+}
+
+// exercises the heap's allocator so the free list has to survive reopening
+int churn(void) {
+    void *a = pheap_malloc(300);
+    void *b = pheap_malloc(5000);
+    if (!a || !b)
+        return 0;
+    b = realloc(b, 20000);
+    if (!b)
+        return 0;
+    free(a);
+    free(b);
+    return 1;
+}
+
+int create(void) {
+    int clean;
+    if (pheap_open(path, HEAP_SIZE, NULL, &clean) || !clean)
+        return 1;
+
+    long *values = pheap_malloc(NUM_VALUES / 2 * sizeof(long));
+    if (!values)
+        return 1;
+    // growing stays inside the persistent heap
+    values = realloc(values, NUM_VALUES * sizeof(long));
+    if (!values)
+        return 1;
+    int i;
+    for (i = 0; i < NUM_VALUES; i++)
+        values[i] = i * 3;
+    if (!churn())
+        return 1;
+    pheap_set_root(values);
+
+    void *base = values;
+    if (write(base_pipe[1], &base, sizeof(base)) != sizeof(base))
+        return 1;
+    return pheap_close() ? 1 : 0;
+}
+
+// reopens the heap and leaves without closing it
+int reopen_and_crash(void *old_root) {
+    int clean;
+    if (pheap_open(path, 0, NULL, &clean) || !clean)
+        return 1;
+    long *values = pheap_get_root();
+    if (values != old_root || !check_values(values) || !churn())
+        return 1;
+    _exit(0);
+}
+
+// reopens the heap with its old range taken, so it has to be relocated
+int reopen_relocated(void *old_root) {
+    void *old_page = (void *)((unsigned long)old_root & ~4095UL);
+    if (mmap(old_page, HEAP_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) ==
+        MAP_FAILED)
+        return 1;
+
+    int clean;
+    if (pheap_open(path, 0, NULL, &clean) || clean)
+        return 1;
+    long *values = pheap_get_root();
+    if (!values || values == old_root || !check_values(values) || !churn())
+        return 1;
+    return pheap_close() ? 1 : 0;
+}
+
+int reopen_clean(void) {
+    int clean;
+    if (pheap_open(path, 0, NULL, &clean) || !clean)
+        return 1;
+    long *values = pheap_get_root();
+    if (!values || !check_values(values))
+        return 1;
+    return pheap_close() ? 1 : 0;
+}
+
+// runs step in a fresh child, as a separate process would open the heap
+int run(int step, void *old_root) {
+    pid_t pid = fork();
+    if (pid < 0)
+        return 0;
+    if (!pid) {
+        switch (step) {
+        case 0:
+            _exit(create());
+        case 1:
+            _exit(reopen_and_crash(old_root));
+        case 2:
+            _exit(reopen_relocated(old_root));
+        default:
+            _exit(reopen_clean());
+        }
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+int main(int argc, char *argv[]) {
+    malloc(1);
+
+    if (!pheap_open) {
+        fprintf(stderr, "pheap_open is not available!\n");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "/tmp/tester-16-%d.heap", (int)getpid());
+    unlink(path);
+    if (pipe(base_pipe))
+        return 1;
+
+    void *root = NULL;
+    int ok = run(0, NULL) && read(base_pipe[0], &root, sizeof(root)) == sizeof(root);
+    const char *failed = "Persistent heap failed to be created!";
+    if (ok) {
+        ok = run(1, root);
+        failed = "Persistent heap failed to be reopened at its address!";
+    }
+    if (ok) {
+        ok = run(2, root);
+        failed = "Persistent heap failed to be relocated or report an unclean exit!";
+    }
+    if (ok) {
+        ok = run(3, root);
+        failed = "Persistent heap failed to be reopened after relocation!";
+    }
+    unlink(path);
+
+    if (!ok) {
+        fprintf(stderr, "%s\n", failed);
+        return 1;
+    }
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
@@ -0,0 +1,90 @@
+/**
+ * malloc
+ * CS 341 - Fall 2025
+ */
+#include "tester-utils.h"
+
+#include "../alloc.h"
+
+// resolved only when alloc.so is preloaded
+#pragma weak malloc_reclaimable
+#pragma weak malloc_pin
+#pragma weak malloc_unpin
+#pragma weak malloc_reclaim
+
+#define BLOCK_SIZE (64 * K + 100)
+
+int fail(const char *what) {
+    fprintf(stderr, "%s\n", what);
+    return 1;
+}
+
+// an unpinned block must not be touched, so contents are only checked
+// after malloc_pin() has returned
+int main(int argc, char *argv[]) {
+    malloc(1);
+
+    if (!malloc_reclaimable)
+        return fail("malloc_reclaimable is not available!");
+
+    // unpinned blocks keep their contents when nothing reclaims them
+    char *kept = malloc_reclaimable(BLOCK_SIZE);
+    if (!kept)
+        return fail("Memory failed to allocate!");
+    memset(kept, 'k', BLOCK_SIZE);
+    int round;
+    for (round = 0; round < 10; round++) {
+        malloc_unpin(kept);
+        if (malloc_pin(kept) != 1)
+            return fail("Unpinned block lost its contents!");
+        verify(kept, 'k', BLOCK_SIZE);
+    }
+
+    // pins nest, so a block pinned twice survives one unpin and a reclaim
+    malloc_pin(kept);
+    malloc_unpin(kept);
+    malloc_reclaim(SIZE_MAX);
+    verify(kept, 'k', BLOCK_SIZE);
+
+    // a reclaimed block comes back usable but has to be regenerated
+    char *lost = malloc_reclaimable(BLOCK_SIZE);
+    if (!lost)
+        return fail("Memory failed to allocate!");
+    memset(lost, 'l', BLOCK_SIZE);
+    malloc_unpin(lost);
+    if (malloc_reclaim(SIZE_MAX) < BLOCK_SIZE)
+        return fail("Reclaim released too little!");
+    if (malloc_pin(lost) != 0)
+        return fail("Reclaimed block kept its contents!");
+    memset(lost, 'r', BLOCK_SIZE);
+    malloc_unpin(lost);
+    if (malloc_pin(lost) != 1)
+        return fail("Regenerated block lost its contents!");
+    verify(lost, 'r', BLOCK_SIZE);
+
+    // the least recently unpinned block goes first
+    char *older = malloc_reclaimable(BLOCK_SIZE);
+    char *newer = malloc_reclaimable(BLOCK_SIZE);
+    if (!older || !newer)
+        return fail("Memory failed to allocate!");
+    memset(older, 'o', BLOCK_SIZE);
+    memset(newer, 'n', BLOCK_SIZE);
+    malloc_unpin(older);
+    malloc_unpin(newer);
+    malloc_reclaim(1);
+    if (malloc_pin(newer) != 1)
+        return fail("Most recently unpinned block was reclaimed first!");
+    verify(newer, 'n', BLOCK_SIZE);
+    if (malloc_pin(older) != 0)
+        return fail("Least recently unpinned block was not reclaimed!");
+
+    // both pinned and unpinned blocks can be freed
+    malloc_unpin(newer);
+    free(kept);
+    free(lost);
+    free(older);
+    free(newer);
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
@@ -0,0 +1,123 @@
+/**
+ * malloc
+ * CS 341 - Fall 2025
+ */
+#include "tester-utils.h"
+#include <stdint.h>
+
+#include "../alloc.h"
+
+// resolved only when alloc.so is preloaded
+#pragma weak malloc_iov
+#pragma weak free_iov
+
+#define NUM_HOLES 40
+#define KEEP_SIZE 600
+#define MAX_IOV 64
+
+static char *keep[NUM_HOLES + 1];
+static struct iovec iov[MAX_IOV + 1];
+
+int fail(const char *what) {
+    fprintf(stderr, "%s\n", what);
+    return 1;
+}
+
+// odd sizes, too large for slabs and too small for runs
+size_t hole_size(int i) {
+    return 301 + 38 * i;
+}
+
+// leaves the heap's free list holding odd-sized blocks between live ones,
+// so a request has to be pieced together from several of them
+void make_holes(void) {
+    char *hole[NUM_HOLES];
+    int i;
+    for (i = 0; i < NUM_HOLES; i++) {
+        keep[i] = malloc(KEEP_SIZE);
+        memset(keep[i], 'k', KEEP_SIZE);
+        hole[i] = malloc(hole_size(i));
+    }
+    keep[NUM_HOLES] = malloc(KEEP_SIZE);
+    memset(keep[NUM_HOLES], 'k', KEEP_SIZE);
+    for (i = 0; i < NUM_HOLES; i++)
+        free(hole[i]);
+}
+
+// every piece must be inside its own block: filling each one must not reach
+// another piece or a live neighbour
+int check_iov(int n, size_t total, int max_iov) {
+    if (n < 1 || n > max_iov)
+        return fail("malloc_iov returned a bad count!");
+    if (iov[max_iov].iov_base != iov || iov[max_iov].iov_len != 1)
+        return fail("malloc_iov wrote past max_iov!");
+
+    size_t sum = 0;
+    int i, j;
+    for (i = 0; i < n; i++) {
+        if (!iov[i].iov_base || !iov[i].iov_len)
+            return fail("malloc_iov returned an empty piece!");
+        sum += iov[i].iov_len;
+        for (j = 0; j < i; j++)
+            if (overlap(iov[i].iov_base, iov[i].iov_len, iov[j].iov_base, iov[j].iov_len))
+                return fail("malloc_iov returned overlapping pieces!");
+    }
+    if (sum != total)
+        return fail("malloc_iov pieces do not add up to the total!");
+
+    for (i = 0; i < n; i++)
+        memset(iov[i].iov_base, 'a' + i % 26, iov[i].iov_len);
+    for (i = 0; i < n; i++)
+        verify(iov[i].iov_base, 'a' + i % 26, iov[i].iov_len);
+    for (i = 0; i <= NUM_HOLES; i++)
+        verify(keep[i], 'k', KEEP_SIZE);
+    return 0;
+}
+
+// runs malloc_iov with a marker just past max_iov, which it must not touch
+int run(size_t total, size_t min_chunk, int max_iov) {
+    iov[max_iov].iov_base = iov;
+    iov[max_iov].iov_len = 1;
+    int n = malloc_iov(total, min_chunk, iov, max_iov);
+    if (check_iov(n, total, max_iov))
+        return 1;
+    free_iov(iov, n);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    malloc(1);
+
+    if (!malloc_iov)
+        return fail("malloc_iov is not available!");
+
+    // an odd total larger than all the holes, with room for many pieces
+    size_t holes = 0;
+    int i;
+    for (i = 0; i < NUM_HOLES; i++)
+        holes += hole_size(i);
+    make_holes();
+    if (run(holes + 1001, 33, MAX_IOV))
+        return 1;
+
+    // fewer slots than holes, the last one takes everything left
+    make_holes();
+    if (run(holes - 7, 1, 5))
+        return 1;
+
+    // a single slot is one ordinary block
+    if (run(12345, 0, 1))
+        return 1;
+
+    // totals that wrap when aligned fail without touching the array
+    iov[0].iov_base = NULL;
+    iov[2].iov_base = iov;
+    iov[2].iov_len = 1;
+    if (malloc_iov(SIZE_MAX - 3, 16, iov, 2) != -1)
+        return fail("malloc_iov accepted a total that wraps!");
+    if (iov[0].iov_base || iov[2].iov_base != iov)
+        return fail("Failed malloc_iov wrote to the array!");
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * malloc
+ * CS 341 - Fall 2025
+ */
+#include "tester-utils.h"
+#include <stdint.h>
+
+#include "../alloc.h"
+
+// resolved only when alloc.so is preloaded
+#pragma weak malloc_soa
+#pragma weak realloc_soa
+
+#define NUM_ARRAYS 4
+#define ALIGN 64
+
+static const size_t elem_sizes[NUM_ARRAYS] = {1, 4, 8, 3};
+
+int fail(const char *what) {
+    fprintf(stderr, "%s\n", what);
+    return 1;
+}
+
+char pattern(size_t k, size_t i) {
+    return (char)(k * 31 + i * 7 + 1);
+}
+
+void fill(void *ptrs[], size_t from, size_t count) {
+    size_t k, i;
+    for (k = 0; k < NUM_ARRAYS; k++)
+        for (i = from * elem_sizes[k]; i < count * elem_sizes[k]; i++)
+            ((char *)ptrs[k])[i] = pattern(k, i);
+}
+
+// each array starts aligned where the layout puts it, right after the
+// previous one, and holds what was written to its first count elements
+int check(void *base, void *ptrs[], size_t count, size_t kept) {
+    if (ptrs[0] != base)
+        return fail("First array does not start the block!");
+    size_t offset = 0, k, i;
+    for (k = 0; k < NUM_ARRAYS; k++) {
+        if ((char *)ptrs[k] != (char *)base + offset || (uintptr_t)ptrs[k] % ALIGN)
+            return fail("Array is not at its aligned offset!");
+        offset = (offset + count * elem_sizes[k] + ALIGN - 1) & ~((size_t)ALIGN - 1);
+        for (i = 0; i < kept * elem_sizes[k]; i++)
+            if (((char *)ptrs[k])[i] != pattern(k, i))
+                return fail("Array lost its contents when resized!");
+    }
+    return 0;
+}
+
+// grows and shrinks a block, with kept elements checked after every step
+int resize_test(size_t count, int blocked) {
+    void *ptrs[NUM_ARRAYS];
+    void *base = malloc_soa(count, NUM_ARRAYS, elem_sizes, ALIGN, ptrs);
+    if (!base)
+        return fail("Memory failed to allocate!");
+    if (check(base, ptrs, count, 0))
+        return 1;
+    fill(ptrs, 0, count);
+
+    // the memory after the block is taken, so it has to move
+    char *blocker = blocked ? malloc(4 * K) : NULL;
+
+    size_t counts[] = {count * 3, count * 3 + 5, count / 2, count * 8};
+    size_t step, old_count = count;
+    for (step = 0; step < sizeof(counts) / sizeof(counts[0]); step++) {
+        size_t new_count = counts[step];
+        base = realloc_soa(base, old_count, new_count, NUM_ARRAYS, elem_sizes, ALIGN, ptrs);
+        if (!base)
+            return fail("Memory failed to reallocate!");
+        size_t kept = MIN(old_count, new_count);
+        if (check(base, ptrs, new_count, kept))
+            return 1;
+        fill(ptrs, kept, new_count);
+        old_count = new_count;
+    }
+
+    free(blocker);
+    free(base);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    malloc(1);
+
+    if (!malloc_soa)
+        return fail("malloc_soa is not available!");
+
+    // heap blocks, grown in place and moved, then onto runs
+    if (resize_test(200, 0) || resize_test(200, 1))
+        return 1;
+    // mappings, which grow with mremap
+    if (resize_test(100 * K, 0))
+        return 1;
+
+    // the same element count and a NULL base behave like malloc_soa
+    void *ptrs[NUM_ARRAYS];
+    void *base = realloc_soa(NULL, 0, 500, NUM_ARRAYS, elem_sizes, ALIGN, ptrs);
+    if (!base || check(base, ptrs, 500, 0))
+        return fail("realloc_soa of NULL failed!");
+    fill(ptrs, 0, 500);
+    base = realloc_soa(base, 500, 500, NUM_ARRAYS, elem_sizes, ALIGN, ptrs);
+    if (!base || check(base, ptrs, 500, 500))
+        return 1;
+    free(base);
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * malloc
+ * CS 341 - Fall 2025
+ */
+#include "tester-utils.h"
+#include <stdint.h>
+
+#include "../alloc.h"
+
+// resolved only when alloc.so is preloaded
+#pragma weak malloc_simd
+#pragma weak malloc_simd_zeropad
+
+#define NUM_DIRTY 64
+
+static const size_t widths[] = {8, 16, 32, 64, 128, 4096};
+static const size_t sizes[] = {1, 7, 33, 100, 1001, 5000, 70001, 2 * M + 3};
+
+#define NUM_WIDTHS (sizeof(widths) / sizeof(widths[0]))
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+int fail(const char *what) {
+    fprintf(stderr, "%s\n", what);
+    return 1;
+}
+
+// frees blocks full of garbage, so padding that is not cleared shows up
+void dirty(void) {
+    char *blocks[NUM_DIRTY];
+    int i;
+    for (i = 0; i < NUM_DIRTY; i++) {
+        size_t size = sizes[i % NUM_SIZES] + widths[i % NUM_WIDTHS];
+        blocks[i] = malloc(size);
+        memset(blocks[i], 0xa5, size);
+    }
+    for (i = 0; i < NUM_DIRTY; i++)
+        free(blocks[i]);
+}
+
+// the block is aligned and can be written up to the next vector boundary
+int check(char *ptr, size_t nbytes, size_t width, int zero_pad) {
+    if (!ptr)
+        return fail("Memory failed to allocate!");
+    if ((uintptr_t)ptr % width)
+        return fail("Block is not aligned to the vector width!");
+    size_t padded = (nbytes + width - 1) & ~(width - 1);
+    size_t i;
+    if (zero_pad)
+        for (i = nbytes; i < padded; i++)
+            if (ptr[i])
+                return fail("Tail padding was not zeroed!");
+    memset(ptr, 'v', padded);
+    verify(ptr, 'v', padded);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    malloc(1);
+
+    if (!malloc_simd)
+        return fail("malloc_simd is not available!");
+
+    size_t w, s;
+    for (w = 0; w < NUM_WIDTHS; w++) {
+        for (s = 0; s < NUM_SIZES; s++) {
+            dirty();
+            char *plain = malloc_simd(sizes[s], widths[w]);
+            if (check(plain, sizes[s], widths[w], 0))
+                return 1;
+            dirty();
+            char *padded = malloc_simd_zeropad(sizes[s], widths[w]);
+            if (check(padded, sizes[s], widths[w], 1))
+                return 1;
+            free(plain);
+            free(padded);
+        }
+    }
+
+    // widths must be powers of two
+    if (malloc_simd(100, 0) || malloc_simd(100, 24) || malloc_simd_zeropad(100, 48))
+        return fail("malloc_simd accepted a bad vector width!");
+    if (malloc_simd(0, 16))
+        return fail("malloc_simd allocated zero bytes!");
+
+    fprintf(stderr, "Memory was allocated, used, and freed!\n");
+    return 0;
+}
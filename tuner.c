@@ -0,0 +1,370 @@
+/**
+ * Trace-driven tuner for the ALLOC_CONF tunables.
+ *
+ * Replays a trace recorded with trace_fd against alloc.so under different
+ * settings and prints the one that minimizes the objective, ready to use:
+ *
+ *     ALLOC_CONF=trace_fd:9 LD_PRELOAD=./alloc.so ./program 9>program.trace
+ *     ./tuner [-o time|rss|mix] [-w time_weight] [-n runs] [-p passes] [-l ./alloc.so] program.trace
+ *
+ * The search is coordinate descent: each tunable in turn is scaled up and
+ * down by a factor, keeping changes that improve the objective, and the
+ * factor is halved once a whole pass improves nothing. The result is checked
+ * against the defaults once more at the end, falling back to them if the
+ * gain does not hold up.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc.h"
+
+#define MAX_RUNS 15
+#define MIN_GAIN 0.03   // improvements smaller than this are taken as noise
+#define PAGE 4096
+
+// a tunable searched over, defaults must match alloc.c
+typedef struct param {
+    const char* name;
+    size_t value;       // default in alloc.c, the search works on a copy
+    size_t lo;
+    size_t hi;
+    size_t on;          // first value tried for tunables that default to off
+} param_t;
+
+static param_t params[] = {
+    {"grow_step", 64 << 10, PAGE, 1UL << 30, 0},
+    {"split_min", 8, 8, 4096, 0},
+    {"mmap_threshold", 1 << 20, 128 << 10, 1UL << 30, 0},
+    {"trim_threshold", 0, 64 << 10, 1UL << 30, 128 << 10},
+    {"pregrow_low", 0, 256 << 10, 1UL << 30, 1 << 20},
+    {"decay_ms", 1000, 0, 60000, 0},
+    {"huge_cache_max", 4UL << 30, 0, 64UL << 30, 0},
+    {"slab_max", 256, 0, 256, 0},
+};
+
+#define PARAMS (sizeof(params) / sizeof(params[0]))
+
+typedef struct result {
+    double time_ms;
+    long rss_kb;
+} result_t;
+
+static const char* objective = "time";
+static double time_weight = 0.5;
+static int runs = 3;
+static int max_passes = 8;
+static const char* library = "./alloc.so";
+static const char* trace_path;
+static result_t baseline;
+
+// recorded addresses to the blocks the replay got for them, open addressing
+// with key 0 empty and 1 deleted
+typedef struct slot {
+    uint64_t key;
+    void* ptr;
+} slot_t;
+
+static slot_t* table;
+static size_t table_mask;
+
+slot_t* table_find(uint64_t key, int insert) {
+    size_t i = (size_t)((key >> 4) * 0x9e3779b97f4a7c15ULL) & table_mask;
+    slot_t* free_slot = NULL;
+    for (;; i = (i + 1) & table_mask) {
+        if (table[i].key == key) return &table[i];
+        if (table[i].key == 1 && !free_slot) free_slot = &table[i];
+        if (!table[i].key) return !insert ? NULL : free_slot ? free_slot : &table[i];
+    }
+}
+
+void table_put(uint64_t key, void* ptr) {
+    if (!key) return;
+    slot_t* slot = table_find(key, 1);
+    slot->key = key;
+    slot->ptr = ptr;
+}
+
+// the block recorded at key, removed from the table; blocks the trace lost
+// track of, e.g. to a race between threads, come back NULL
+void* table_take(uint64_t key) {
+    slot_t* slot = key ? table_find(key, 0) : NULL;
+    if (!slot) return NULL;
+    slot->key = 1;
+    return slot->ptr;
+}
+
+// writes a byte per page, as the program would have used the block
+void touch(char* ptr, size_t size) {
+    size_t off;
+    if (ptr)
+        for (off = 0; off < size; off += PAGE) ((volatile char*)ptr)[off] = 1;
+}
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// runs in the child under the preloaded allocator, prints the elapsed time
+int replay(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return 1;
+    }
+    size_t count = st.st_size / sizeof(alloc_trace_t);
+    if (!count) {
+        fprintf(stderr, "%s: empty trace\n", path);
+        return 1;
+    }
+    // neither the trace nor the table is allocated with malloc
+    const alloc_trace_t* trace = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    size_t slots = 2;
+    while (slots < 2 * count) slots <<= 1;
+    table = mmap(NULL, slots * sizeof(slot_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (trace == MAP_FAILED || table == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    table_mask = slots - 1;
+
+    double start = now_ms();
+    size_t i;
+    for (i = 0; i < count; i++) {
+        const alloc_trace_t* call = &trace[i];
+        void* ptr;
+        switch (call->op) {
+            case ALLOC_TRACE_MALLOC:
+                ptr = malloc(call->size);
+                touch(ptr, call->size);
+                table_put(call->ptr, ptr);
+                break;
+            case ALLOC_TRACE_CALLOC:
+                ptr = calloc(1, call->size);
+                touch(ptr, call->size);
+                table_put(call->ptr, ptr);
+                break;
+            case ALLOC_TRACE_REALLOC:
+                ptr = table_take(call->old);
+                if (call->old && !ptr) break;
+                ptr = realloc(ptr, call->size);
+                touch(ptr, call->size);
+                table_put(call->ptr, ptr);
+                break;
+            case ALLOC_TRACE_FREE:
+                free(table_take(call->ptr));
+                break;
+        }
+    }
+    printf("%f\n", now_ms() - start);
+    return 0;
+}
+
+// formats a value the way ALLOC_CONF reads it
+void format_value(char* buf, size_t len, size_t value) {
+    if (value && !(value & ((1UL << 30) - 1))) snprintf(buf, len, "%zug", value >> 30);
+    else if (value && !(value & ((1UL << 20) - 1))) snprintf(buf, len, "%zum", value >> 20);
+    else if (value && !(value & ((1UL << 10) - 1))) snprintf(buf, len, "%zuk", value >> 10);
+    else snprintf(buf, len, "%zu", value);
+}
+
+// the settings that differ from alloc.c's defaults
+void format_conf(char* buf, size_t len, const size_t* values) {
+    size_t i, used = 0;
+    buf[0] = '\0';
+    for (i = 0; i < PARAMS; i++) {
+        if (values[i] == params[i].value) continue;
+        char value[32];
+        format_value(value, sizeof(value), values[i]);
+        used += snprintf(buf + used, len - used, "%s%s:%s", used ? "," : "", params[i].name, value);
+    }
+}
+
+// replays the trace once, returns 0 on failure
+int run_once(const char* conf, result_t* result) {
+    extern char** environ;
+    static char* envp[4096];
+    char preload[4096], alloc_conf[4096];
+    size_t n = 0;
+    char** env;
+
+    snprintf(preload, sizeof(preload), "LD_PRELOAD=%s", library);
+    snprintf(alloc_conf, sizeof(alloc_conf), "ALLOC_CONF=%s", conf);
+    for (env = environ; *env && n < 4093; env++)
+        if (strncmp(*env, "LD_PRELOAD=", 11) && strncmp(*env, "ALLOC_CONF=", 11)) envp[n++] = *env;
+    envp[n++] = preload;
+    envp[n++] = alloc_conf;
+    envp[n] = NULL;
+
+    int out[2];
+    if (pipe(out) < 0) return 0;
+    pid_t pid = fork();
+    if (pid < 0) return 0;
+    if (!pid) {
+        char* argv[] = {"tuner", "-x", (char*)trace_path, NULL};
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        execve("/proc/self/exe", argv, envp);
+        _exit(127);
+    }
+    close(out[1]);
+
+    char buf[64];
+    ssize_t got = read(out[0], buf, sizeof(buf) - 1);
+    close(out[0]);
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {}
+    if (got <= 0 || !WIFEXITED(status) || WEXITSTATUS(status)) return 0;
+
+    buf[got] = '\0';
+    result->time_ms = atof(buf);
+    result->rss_kb = usage.ru_maxrss;
+    return 1;
+}
+
+int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// fastest time and median peak RSS over the runs, as noise only ever adds
+// time; returns 0 if the settings broke the replay
+int evaluate(const size_t* values, result_t* result) {
+    char conf[4096];
+    double times[MAX_RUNS], rss[MAX_RUNS];
+    int i;
+
+    format_conf(conf, sizeof(conf), values);
+    for (i = 0; i < runs; i++) {
+        result_t one;
+        if (!run_once(conf, &one)) return 0;
+        times[i] = one.time_ms;
+        rss[i] = one.rss_kb;
+    }
+    qsort(times, runs, sizeof(double), compare_double);
+    qsort(rss, runs, sizeof(double), compare_double);
+    result->time_ms = times[0];
+    result->rss_kb = (long)rss[runs / 2];
+    return 1;
+}
+
+// relative to the defaults, lower is better
+double score(const result_t* result) {
+    double time = result->time_ms / baseline.time_ms;
+    double rss = (double)result->rss_kb / baseline.rss_kb;
+    if (!strcmp(objective, "rss")) return rss;
+    if (!strcmp(objective, "mix")) return time_weight * time + (1 - time_weight) * rss;
+    return time;
+}
+
+// values tried next for a tunable, returns how many
+int candidates(const param_t* param, size_t value, size_t factor, size_t* out) {
+    int n = 0;
+    if (!value) {
+        if (param->on) out[n++] = param->on;
+        return n;
+    }
+    size_t down = value / factor < param->lo ? param->lo : value / factor;
+    size_t up = value > param->hi / factor ? param->hi : value * factor;
+    if (down != value) out[n++] = down;
+    if (up != value) out[n++] = up;
+    // off is only worth trying on the coarse passes
+    if (param->on && factor > 2) out[n++] = 0;
+    return n;
+}
+
+void usage(void) {
+    fprintf(stderr, "usage: tuner [-o time|rss|mix] [-w time_weight] [-n runs] [-p passes] [-l alloc.so] trace\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && !strcmp(argv[1], "-x")) return replay(argv[2]);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:w:n:p:l:")) != -1) {
+        switch (opt) {
+            case 'o': objective = optarg; break;
+            case 'w': time_weight = atof(optarg); break;
+            case 'n': runs = atoi(optarg); break;
+            case 'p': max_passes = atoi(optarg); break;
+            case 'l': library = optarg; break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1) usage();
+    if (strcmp(objective, "time") && strcmp(objective, "rss") && strcmp(objective, "mix")) usage();
+    if (runs < 1 || runs > MAX_RUNS || time_weight < 0 || time_weight > 1) usage();
+    trace_path = argv[optind];
+
+    size_t values[PARAMS], i;
+    for (i = 0; i < PARAMS; i++) values[i] = params[i].value;
+    if (!evaluate(values, &baseline)) {
+        fprintf(stderr, "tuner: replaying %s with %s failed\n", trace_path, library);
+        return 1;
+    }
+    fprintf(stderr, "defaults: %.2f ms, %ld KB\n", baseline.time_ms, baseline.rss_kb);
+
+    double best = 1.0;
+    size_t factor = 4;
+    int pass;
+    for (pass = 0; pass < max_passes && factor >= 2; pass++) {
+        int improved = 0;
+        for (i = 0; i < PARAMS; i++) {
+            size_t tries[3], current = values[i];
+            int n = candidates(&params[i], current, factor, tries), j;
+            for (j = 0; j < n; j++) {
+                result_t result;
+                char conf[4096];
+                values[i] = tries[j];
+                format_conf(conf, sizeof(conf), values);
+                if (!evaluate(values, &result)) {
+                    fprintf(stderr, "  %-60s failed\n", conf);
+                    continue;
+                }
+                double s = score(&result);
+                int better = s < best * (1 - MIN_GAIN);
+                fprintf(stderr, "  %-60s %.2f ms, %ld KB, score %.3f%s\n", conf, result.time_ms, result.rss_kb, s,
+                        better ? " *" : "");
+                if (better) {
+                    best = s;
+                    current = tries[j];
+                    improved = 1;
+                }
+            }
+            values[i] = current;
+        }
+        if (!improved) factor /= 2;
+    }
+
+    // measure both again, the search keeps whichever run got lucky
+    size_t defaults[PARAMS];
+    result_t tuned;
+    for (i = 0; i < PARAMS; i++) defaults[i] = params[i].value;
+    if (best < 1 && evaluate(defaults, &baseline) && evaluate(values, &tuned)) {
+        best = score(&tuned);
+        fprintf(stderr, "confirmed: %.2f ms, %ld KB against %.2f ms, %ld KB\n", tuned.time_ms, tuned.rss_kb,
+                baseline.time_ms, baseline.rss_kb);
+    }
+    if (best >= 1 - MIN_GAIN) memcpy(values, defaults, sizeof(values));
+
+    char conf[4096];
+    format_conf(conf, sizeof(conf), values);
+    fprintf(stderr, "best score %.3f of the defaults' (%s)\n", best < 1 ? best : 1.0, objective);
+    printf("ALLOC_CONF=%s\n", conf);
+    return 0;
+}